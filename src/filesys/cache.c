@@ -1,129 +1,1127 @@
 #include "filesys/cache.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <debug.h>
+#include <hash.h>
+#include <list.h>
 #include "filesys/filesys.h"
+#include "threads/loader.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
 
-#define CACHE_SIZE 64
+/* The cache grows a slab, one page of sectors, at a time. */
+#define SLAB_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
 
+/* Slabs the cache starts with and never shrinks below. */
+#define CACHE_MIN_SLABS 8
+
+/* How often the flusher checks whether it has work, in ticks. */
+#define FLUSH_POLL_TICKS (TIMER_FREQ / 10)
+
+/* Periodic write-back interval in milliseconds. */
+unsigned cache_flush_interval = 1000;
+
+/* Percentage of dirty entries that wakes the flusher early. */
+unsigned cache_dirty_ratio = 25;
+
+/* Replacement policy. */
+enum cache_policy cache_policy = CACHE_LRU;
+
+/* Most pages of memory the cache may grow to, 0 for an eighth
+   of RAM. */
+unsigned cache_max_pages = 0;
+
+/* Under CACHE_2Q, the number of entries the probation queue may
+   hold before it, rather than cache_list, supplies victims.  As
+   many sectors as the cache holds are remembered after they
+   leave probation, which lets a block be recognized as reused
+   even when a whole cacheful of other blocks has passed through
+   probation since it was evicted. */
+#define PROBATION_MAX (cache_cnt / 4)
+
+/* The number of metadata entries beyond which metadata is evicted
+   in preference to data. */
+#define META_MAX (cache_cnt / 2)
+
+/* Most sectors written back in one transfer. */
+#define WRITE_RUN_MAX 32
+
+/* A cached sector.
+
+   DISK_SECTOR, VALID, DIRTY and the access fields are protected
+   by cache_lock.  BUFFER is protected by the access fields: it
+   may be read by threads holding shared access and written by
+   the one thread holding exclusive access, without cache_lock.
+
+   An entry with a nonzero PIN_CNT is in use by, or being waited
+   for by, some thread.  It keeps its sector and is not on any
+   queue, so it is never chosen for eviction. */
 struct cache_entry
 {
     block_sector_t disk_sector;
-    uint8_t buffer[BLOCK_SECTOR_SIZE];
+    uint8_t *buffer;
     bool valid;
     bool dirty;
-    int recent_used;
-    struct list_elem elem;
+    bool busy;                          /* Disk I/O in progress? */
+    int pin_cnt;                        /* Number of pinning threads. */
+    int readers;                        /* Threads with shared access. */
+    bool writer;                        /* Thread with exclusive access? */
+    bool probation;                     /* On probation_list? */
+    enum cache_class class;             /* What the sector was last used for. */
+    block_sector_t owner;               /* Inode the data belongs to. */
+    struct cache_owner *dirty_owner;    /* Owner whose dirty list has this. */
+    struct list_elem dirty_elem;        /* Element in dirty_owner->dirty. */
+    struct condition access_cond;       /* Signaled when access changes. */
+    struct hash_elem hash_elem;         /* Element in cache_map, if valid. */
+    struct list_elem elem;              /* Element in a queue, if unpinned. */
+};
+
+/* The dirty entries belonging to one inode. */
+struct cache_owner
+{
+    block_sector_t inode_sector;
+    struct list dirty;                  /* Dirty entries, oldest first. */
+    struct hash_elem hash_elem;         /* Element in owner_map. */
+};
+
+/* A sector recently evicted from the probation queue. */
+struct cache_ghost
+{
+    block_sector_t disk_sector;
+    struct hash_elem hash_elem;         /* Element in ghost_map, if in use. */
+    struct list_elem elem;              /* Element in ghost_list or ghost_free. */
 };
 
-static struct cache_entry cache[CACHE_SIZE];
-static struct lock global_lock;
+/* A page of sector buffers and the entries that describe them.
+   Each slab also brings one ghost per entry. */
+struct cache_slab
+{
+    uint8_t *page;                      /* SLAB_SECTORS buffers. */
+    struct list_elem elem;              /* Element in slab_list or spare_slabs. */
+    struct cache_entry entries[SLAB_SECTORS];
+    struct cache_ghost ghosts[SLAB_SECTORS];
+};
+
+/* Slabs in use, newest first, and their total number of entries. */
+static struct list slab_list;
+static size_t slab_cnt;
+static size_t cache_cnt;
+
+/* Most slabs slab_list may hold. */
+static size_t slab_limit;
+
+/* Slab headers whose pages have been given back.  They are kept
+   for reuse rather than freed, because the shrinker runs inside
+   malloc() when malloc() itself needs a page. */
+static struct list spare_slabs;
+
+/* True while some thread is adding a slab. */
+static bool cache_growing;
+
+/* Protects the slabs, cache_map, the queues and entry metadata.  Never held
+   across disk I/O or copies to or from a buffer. */
+static struct lock cache_lock;
+
+/* Signaled when an entry is unpinned and so becomes evictable. */
+static struct condition cache_unpinned;
+
+/* Number of dirty entries. */
+static size_t cache_dirty_cnt;
+
+/* Owners with dirty entries, keyed by inode sector. */
+static struct hash owner_map;
+
+/* Activity counters, protected by cache_lock. */
+static struct cache_stat cache_stats[CACHE_CLASS_CNT];
+
+/* Set to make the flusher run before its interval expires. */
+static volatile bool flush_requested;
+
+/* Valid entries, keyed by disk sector. */
+static struct hash cache_map;
+
+/* Unpinned data entries, most recently used first.  The victim
+   for eviction is taken from the back.  Under CACHE_LRU this
+   holds every unpinned data entry; under CACHE_2Q only those
+   whose sector has been asked for again after being evicted,
+   which is how 2Q tells a working set from a scan that touches
+   each block once. */
 static struct list cache_list;
-static bool cache_recent_used_more (const struct list_elem *lhs, const struct list_elem *rhs, void *aux UNUSED);
+
+/* Unpinned metadata entries, that is, inodes, index blocks and
+   the free map, most recently used first.  These are evicted only
+   when they take up more than META_MAX entries or there is no
+   data left to evict, so that bulk data cannot push out the
+   blocks needed to find it. */
+static struct list meta_list;
+static size_t meta_cnt;                 /* Metadata entries, pinned or not. */
+
+/* Under CACHE_2Q, unpinned entries whose sectors are on probation,
+   most recently used first.  Hits here do not promote an entry to
+   cache_list, since a scan often touches the same block several
+   times in quick succession. */
+static struct list probation_list;
+static size_t probation_cnt;            /* Entries on probation, pinned or not. */
+
+/* Entries that have never held a sector.  These are used before
+   anything is evicted. */
+static struct list free_list;
+
+/* Sectors recently evicted from probation, most recent first,
+   also indexed by sector in ghost_map.  A miss on one of these
+   is a sign of reuse, so the sector goes straight to cache_list. */
+static struct hash ghost_map;
+static struct list ghost_list;
+static struct list ghost_free;
+
+static bool cache_grow (enum palloc_flags);
+static size_t cache_shrink (enum palloc_flags, size_t page_cnt);
+static void cache_flush_daemon (void *aux UNUSED);
+static void cache_flush_entries (bool wait);
+static unsigned cache_hash (const struct hash_elem *e, void *aux UNUSED);
+static bool cache_less (const struct hash_elem *lhs, const struct hash_elem *rhs, void *aux UNUSED);
+static unsigned owner_hash (const struct hash_elem *e, void *aux UNUSED);
+static bool owner_less (const struct hash_elem *lhs, const struct hash_elem *rhs, void *aux UNUSED);
+static unsigned ghost_hash (const struct hash_elem *e, void *aux UNUSED);
+static bool ghost_less (const struct hash_elem *lhs, const struct hash_elem *rhs, void *aux UNUSED);
 
 void
 cache_init (void)
 {
+    list_init (&slab_list);
+    list_init (&spare_slabs);
     list_init (&cache_list);
-    lock_init (&global_lock);
-    for (size_t i = 0; i < CACHE_SIZE; i++)
-    {
-        cache[i].valid = 0;
-        cache[i].dirty = 0;
-        cache[i].recent_used = 0;
-        memset (cache[i].buffer, 0, BLOCK_SECTOR_SIZE);
-        list_push_back (&cache_list, &cache[i].elem);
-    }
+    list_init (&meta_list);
+    list_init (&probation_list);
+    list_init (&free_list);
+    list_init (&ghost_list);
+    list_init (&ghost_free);
+    lock_init (&cache_lock);
+    cond_init (&cache_unpinned);
+    if (!hash_init (&cache_map, cache_hash, cache_less, NULL)
+        || !hash_init (&ghost_map, ghost_hash, ghost_less, NULL)
+        || !hash_init (&owner_map, owner_hash, owner_less, NULL))
+        PANIC ("buffer cache index creation failed");
+    slab_cnt = cache_cnt = probation_cnt = meta_cnt = 0;
+    slab_limit = cache_max_pages != 0 ? cache_max_pages : init_ram_pages / 8;
+    if (slab_limit < CACHE_MIN_SLABS)
+        slab_limit = CACHE_MIN_SLABS;
+    cache_growing = 0;
+    cache_dirty_cnt = 0;
+    memset (cache_stats, 0, sizeof cache_stats);
+    flush_requested = 0;
+
+    lock_acquire (&cache_lock);
+    while (slab_cnt < CACHE_MIN_SLABS)
+        if (!cache_grow (PAL_ASSERT))
+            PANIC ("buffer cache allocation failed");
+    lock_release (&cache_lock);
+    palloc_set_shrinker (cache_shrink);
+    thread_create ("cache-flush", PRI_DEFAULT, cache_flush_daemon, NULL);
+}
+
+/* Selects the replacement policy by NAME, either "lru" or "2q".
+   Must be called before cache_init(). */
+void
+cache_set_policy (const char *name)
+{
+    if (name != NULL && !strcmp (name, "lru"))
+        cache_policy = CACHE_LRU;
+    else if (name != NULL && !strcmp (name, "2q"))
+        cache_policy = CACHE_2Q;
+    else
+        PANIC ("unknown cache policy `%s'", name != NULL ? name : "");
 }
 
 static struct cache_entry *
 cache_lookup (block_sector_t sector)
 {
-    struct cache_entry *ret = NULL;
-    for (size_t i = 0; i < CACHE_SIZE; i++)
+    struct cache_entry key;
+    struct hash_elem *e;
+
+    key.disk_sector = sector;
+    e = hash_find (&cache_map, &key.hash_elem);
+    return e != NULL ? hash_entry (e, struct cache_entry, hash_elem) : NULL;
+}
+
+static void
+cache_pin (struct cache_entry *slot)
+{
+    ASSERT (lock_held_by_current_thread (&cache_lock));
+    if (slot->pin_cnt++ == 0)
+        list_remove (&slot->elem);
+}
+
+/* Returns true if blocks of CLASS are metadata. */
+static inline bool
+cache_class_is_meta (enum cache_class class)
+{
+    return class == CACHE_INODE || class == CACHE_INDEX || class == CACHE_FREE_MAP;
+}
+
+/* Returns the queue the unpinned SLOT belongs on. */
+static struct list *
+cache_queue (const struct cache_entry *slot)
+{
+    if (slot->probation)
+        return &probation_list;
+    return cache_class_is_meta (slot->class) ? &meta_list : &cache_list;
+}
+
+/* Records that the pinned SLOT is now used for a block of CLASS.
+   Metadata is never on probation. */
+static void
+cache_set_class (struct cache_entry *slot, enum cache_class class)
+{
+    bool meta = cache_class_is_meta (class);
+
+    ASSERT (slot->pin_cnt > 0);
+    if (meta != cache_class_is_meta (slot->class))
+    {
+        if (meta)
+            meta_cnt++;
+        else
+            meta_cnt--;
+    }
+    if (meta && slot->probation)
     {
-        cache[i].recent_used ++;
-        if (!cache[i].valid) continue;
-        if (cache[i].disk_sector == sector)
-            ret = &(cache[i]);
+        slot->probation = 0;
+        probation_cnt--;
     }
-    return ret;
+    slot->class = class;
+}
+
+/* Drops a pin on SLOT.  Once unpinned, SLOT becomes the most
+   recently used entry of its queue, or the least recently used
+   one if TO_BACK is true. */
+static void
+cache_unpin (struct cache_entry *slot, bool to_back)
+{
+    ASSERT (lock_held_by_current_thread (&cache_lock));
+    ASSERT (slot->pin_cnt > 0);
+    if (--slot->pin_cnt == 0)
+    {
+        struct list *queue = cache_queue (slot);
+        if (to_back)
+            list_push_back (queue, &slot->elem);
+        else
+            list_push_front (queue, &slot->elem);
+        cond_signal (&cache_unpinned, &cache_lock);
+    }
+}
+
+/* Waits until the pinned SLOT allows shared access, or exclusive
+   access if EXCLUSIVE is true, and takes it. */
+static void
+cache_wait_access (struct cache_entry *slot, bool exclusive)
+{
+    ASSERT (lock_held_by_current_thread (&cache_lock));
+    while (slot->busy || slot->writer || (exclusive && slot->readers > 0))
+        cond_wait (&slot->access_cond, &cache_lock);
+    if (exclusive)
+        slot->writer = 1;
+    else
+        slot->readers++;
 }
 
+/* Remembers that SECTOR was evicted from probation, forgetting
+   the oldest such sector if necessary. */
+static void
+ghost_insert (block_sector_t sector)
+{
+    struct cache_ghost *g;
+
+    if (list_empty (&ghost_free))
+    {
+        g = list_entry (list_pop_back (&ghost_list), struct cache_ghost, elem);
+        hash_delete (&ghost_map, &g->hash_elem);
+    }
+    else
+        g = list_entry (list_pop_front (&ghost_free), struct cache_ghost, elem);
+    g->disk_sector = sector;
+    if (hash_insert (&ghost_map, &g->hash_elem) != NULL)
+        list_push_front (&ghost_free, &g->elem);
+    else
+        list_push_front (&ghost_list, &g->elem);
+}
+
+/* Forgets SECTOR if it was recently evicted from probation, and
+   returns whether it was. */
+static bool
+ghost_remove (block_sector_t sector)
+{
+    struct cache_ghost key;
+    struct hash_elem *e;
+    struct cache_ghost *g;
+
+    key.disk_sector = sector;
+    e = hash_delete (&ghost_map, &key.hash_elem);
+    if (e == NULL)
+        return false;
+    g = hash_entry (e, struct cache_ghost, hash_elem);
+    list_remove (&g->elem);
+    list_push_front (&ghost_free, &g->elem);
+    return true;
+}
+
+/* Returns the unpinned entry to evict next, or a null pointer if
+   every entry is pinned.  Data goes before metadata unless
+   metadata has more than its share of the cache.  Under CACHE_2Q,
+   probation supplies the data victim once it holds more than its
+   share, so that blocks touched only by a scan go before the
+   working set. */
 static struct cache_entry *
-cache_evcit (void)
+cache_victim (void)
 {
-    struct cache_entry *slot = list_entry (list_back (&cache_list), struct cache_entry, elem);
-    if (slot->dirty)
+    struct list *queue = &cache_list;
+
+    if (!list_empty (&free_list))
+        queue = &free_list;
+    else if ((meta_cnt > META_MAX && !list_empty (&meta_list))
+             || (list_empty (&cache_list) && list_empty (&probation_list)))
+        queue = &meta_list;
+    else if (list_empty (&cache_list)
+        || (probation_cnt > PROBATION_MAX && !list_empty (&probation_list)))
+        queue = &probation_list;
+    if (list_empty (queue))
+        return NULL;
+    return list_entry (list_back (queue), struct cache_entry, elem);
+}
+
+/* Reassigns the pinned SLOT, which must not be dirty, to SECTOR,
+   a block of CLASS, and decides which queue it will go on. */
+static void
+cache_assign (struct cache_entry *slot, block_sector_t sector,
+              enum cache_class class)
+{
+    bool reused;
+
+    ASSERT (slot->pin_cnt > 0 && !(slot->valid && slot->dirty));
+    if (slot->valid)
     {
-        block_write (fs_device, slot->disk_sector, slot->buffer);
+        cache_stats[slot->class].evictions++;
+        hash_delete (&cache_map, &slot->hash_elem);
+        if (slot->probation)
+            ghost_insert (slot->disk_sector);
+    }
+    if (slot->probation)
+        probation_cnt--;
+    slot->probation = 0;
+    cache_set_class (slot, class);
+    reused = ghost_remove (sector);
+    slot->probation = (cache_policy == CACHE_2Q && !reused
+                       && !cache_class_is_meta (class));
+    if (slot->probation)
+        probation_cnt++;
+    slot->valid = 1;
+    slot->dirty = 0;
+    slot->owner = CACHE_NO_OWNER;
+    slot->disk_sector = sector;
+    hash_insert (&cache_map, &slot->hash_elem);
+}
+
+/* Returns the owner record for INODE_SECTOR, or a null pointer if
+   it has no dirty entries. */
+static struct cache_owner *
+owner_lookup (block_sector_t inode_sector)
+{
+    struct cache_owner key;
+    struct hash_elem *e;
+
+    key.inode_sector = inode_sector;
+    e = hash_find (&owner_map, &key.hash_elem);
+    return e != NULL ? hash_entry (e, struct cache_owner, hash_elem) : NULL;
+}
+
+/* Puts the dirty SLOT on its owner's dirty list.  If memory for
+   a new owner record is short, SLOT stays off any list and is
+   written back only by a full flush. */
+static void
+cache_link_dirty (struct cache_entry *slot)
+{
+    struct cache_owner *o;
+
+    ASSERT (slot->dirty && slot->dirty_owner == NULL);
+    if (slot->owner == CACHE_NO_OWNER)
+        return;
+    o = owner_lookup (slot->owner);
+    if (o == NULL)
+    {
+        o = malloc (sizeof *o);
+        if (o == NULL)
+            return;
+        o->inode_sector = slot->owner;
+        list_init (&o->dirty);
+        hash_insert (&owner_map, &o->hash_elem);
+    }
+    slot->dirty_owner = o;
+    list_push_back (&o->dirty, &slot->dirty_elem);
+}
+
+/* Takes SLOT off its owner's dirty list, if any. */
+static void
+cache_unlink_dirty (struct cache_entry *slot)
+{
+    struct cache_owner *o = slot->dirty_owner;
+
+    if (o == NULL)
+        return;
+    list_remove (&slot->dirty_elem);
+    slot->dirty_owner = NULL;
+    if (list_empty (&o->dirty))
+    {
+        hash_delete (&owner_map, &o->hash_elem);
+        free (o);
+    }
+}
+
+/* Adds a slab to the cache, allocating its page with FLAGS and
+   releasing cache_lock meanwhile.  Returns false if memory is
+   short.  The page is not taken from the shrinker, since that
+   would only shrink the cache itself. */
+static bool
+cache_grow (enum palloc_flags flags)
+{
+    struct cache_slab *slab = NULL;
+    uint8_t *page;
+
+    ASSERT (!cache_growing);
+    if (!list_empty (&spare_slabs))
+        slab = list_entry (list_pop_front (&spare_slabs), struct cache_slab, elem);
+    cache_growing = 1;
+    lock_release (&cache_lock);
+    page = palloc_get_page (flags | PAL_NORECLAIM);
+    if (page != NULL && slab == NULL)
+        slab = malloc (sizeof *slab);
+    lock_acquire (&cache_lock);
+    cache_growing = 0;
+
+    if (page == NULL || slab == NULL)
+    {
+        if (slab != NULL)
+            list_push_front (&spare_slabs, &slab->elem);
+        palloc_free_page (page);
+        return false;
+    }
+    slab->page = page;
+    for (size_t i = 0; i < SLAB_SECTORS; i++)
+    {
+        struct cache_entry *slot = &slab->entries[i];
+        slot->buffer = page + i * BLOCK_SECTOR_SIZE;
+        slot->valid = 0;
         slot->dirty = 0;
+        slot->busy = 0;
+        slot->pin_cnt = 0;
+        slot->readers = 0;
+        slot->writer = 0;
+        slot->probation = 0;
+        slot->class = CACHE_DATA;
+        slot->owner = CACHE_NO_OWNER;
+        slot->dirty_owner = NULL;
+        cond_init (&slot->access_cond);
+        list_push_back (&free_list, &slot->elem);
+        slab->ghosts[i].disk_sector = 0;
+        list_push_back (&ghost_free, &slab->ghosts[i].elem);
     }
-    slot->valid = 0;
-    return slot;
+    list_push_front (&slab_list, &slab->elem);
+    slab_cnt++;
+    cache_cnt += SLAB_SECTORS;
+    cond_broadcast (&cache_unpinned, &cache_lock);
+    return true;
 }
 
-void
-cache_read (block_sector_t sector, void *target)
+/* Returns true if no entry in SLAB is pinned or dirty. */
+static bool
+cache_slab_idle (const struct cache_slab *slab)
+{
+    for (size_t i = 0; i < SLAB_SECTORS; i++)
+        if (slab->entries[i].pin_cnt > 0 || slab->entries[i].dirty)
+            return false;
+    return true;
+}
+
+/* Takes the idle SLAB out of the cache, forgetting the sectors its
+   entries and ghosts hold, and returns its page. */
+static void *
+cache_slab_drop (struct cache_slab *slab)
 {
-    lock_acquire (&global_lock);
-    struct cache_entry *slot = cache_lookup (sector);
-    if (slot == NULL)
+    for (size_t i = 0; i < SLAB_SECTORS; i++)
     {
-        slot = cache_evcit ();
-        slot->valid = 1;
+        struct cache_entry *slot = &slab->entries[i];
+        struct cache_ghost *g = &slab->ghosts[i];
+
+        list_remove (&slot->elem);
+        if (slot->valid)
+            hash_delete (&cache_map, &slot->hash_elem);
+        if (slot->probation)
+            probation_cnt--;
+        if (cache_class_is_meta (slot->class))
+            meta_cnt--;
+
+        /* A ghost is in use only if it is the one ghost_map
+           finds for its sector. */
+        if (hash_find (&ghost_map, &g->hash_elem) == &g->hash_elem)
+            hash_delete (&ghost_map, &g->hash_elem);
+        list_remove (&g->elem);
+    }
+    list_remove (&slab->elem);
+    list_push_front (&spare_slabs, &slab->elem);
+    slab_cnt--;
+    cache_cnt -= SLAB_SECTORS;
+    return slab->page;
+}
+
+/* Page allocator shrinker.  Gives back up to PAGE_CNT pages by
+   dropping the oldest slabs that have nothing pinned or dirty,
+   keeping CACHE_MIN_SLABS.  Dirty entries cannot be written back
+   here, since the thread that ran out of memory may hold locks
+   the write needs, so the flusher is asked to clean them for next
+   time.  The slabs come from the kernel pool, so running out of
+   user pages is no reason to shrink. */
+static size_t
+cache_shrink (enum palloc_flags flags, size_t page_cnt)
+{
+    size_t freed = 0;
+    struct list_elem *e;
+
+    if ((flags & PAL_USER) || lock_held_by_current_thread (&cache_lock)
+        || !lock_try_acquire (&cache_lock))
+        return 0;
+    e = list_rbegin (&slab_list);
+    while (e != list_rend (&slab_list) && freed < page_cnt
+           && slab_cnt > CACHE_MIN_SLABS)
+    {
+        struct cache_slab *slab = list_entry (e, struct cache_slab, elem);
+        e = list_prev (e);
+        if (cache_slab_idle (slab))
+        {
+            palloc_free_page (cache_slab_drop (slab));
+            freed++;
+        }
+    }
+    if (freed < page_cnt && cache_dirty_cnt > 0)
+        flush_requested = 1;
+    lock_release (&cache_lock);
+    return freed;
+}
+
+/* Writes the CNT dirty, pinned entries in SLOTS, which hold
+   consecutive sectors and to which the caller has shared access,
+   back to disk in one transfer, releasing cache_lock meanwhile.
+   Drops the caller's access afterward.  Other threads wanting
+   the entries wait until the write completes. */
+static void
+cache_write_run (struct cache_entry **slots, size_t cnt)
+{
+    const void *buffers[WRITE_RUN_MAX];
+    size_t i;
+
+    ASSERT (cnt > 0 && cnt <= WRITE_RUN_MAX);
+    for (i = 0; i < cnt; i++)
+    {
+        ASSERT (slots[i]->dirty && slots[i]->readers > 0);
+        ASSERT (slots[i]->disk_sector == slots[0]->disk_sector + i);
+        slots[i]->busy = 1;
+        buffers[i] = slots[i]->buffer;
+    }
+    lock_release (&cache_lock);
+    block_write_multiple (fs_device, slots[0]->disk_sector, cnt, buffers);
+    lock_acquire (&cache_lock);
+    for (i = 0; i < cnt; i++)
+    {
+        struct cache_entry *slot = slots[i];
+        slot->busy = 0;
         slot->dirty = 0;
-        slot->disk_sector = sector;
+        cache_unlink_dirty (slot);
+        cache_dirty_cnt--;
+        cache_stats[slot->class].write_backs++;
+        slot->readers--;
+        cond_broadcast (&slot->access_cond, &cache_lock);
+    }
+}
+
+/* Writes the pinned SLOT back to disk if it is dirty, releasing
+   cache_lock during the transfer.  Other threads wanting SLOT
+   wait until the write completes. */
+static void
+cache_write_back (struct cache_entry *slot)
+{
+    ASSERT (slot->pin_cnt > 0);
+    cache_wait_access (slot, false);
+    if (slot->dirty)
+        cache_write_run (&slot, 1);
+    else
+    {
+        slot->readers--;
+        cond_broadcast (&slot->access_cond, &cache_lock);
+    }
+}
+
+/* Orders pointers to cache entries by sector. */
+static int
+compare_sectors (const void *a_, const void *b_)
+{
+    const struct cache_entry *a = *(struct cache_entry *const *) a_;
+    const struct cache_entry *b = *(struct cache_entry *const *) b_;
+
+    return a->disk_sector < b->disk_sector ? -1 : a->disk_sector > b->disk_sector;
+}
+
+/* Writes back the CNT pinned entries in SLOTS that are dirty, in
+   order of sector, like an elevator, and unpins them all.  Runs
+   of consecutive sectors go to disk as single transfers.
+   Reorders SLOTS.
+
+   An entry that another thread is modifying or doing I/O on is
+   put off until every run is written, so that no thread waits
+   for access while holding pins on a large part of the cache. */
+static void
+cache_write_sorted (struct cache_entry **slots, size_t cnt)
+{
+    size_t i = 0, deferred = 0, j;
+
+    qsort (slots, cnt, sizeof *slots, compare_sectors);
+    while (i < cnt)
+    {
+        size_t start = i++;
+        struct cache_entry *slot = slots[start];
+
+        if (!slot->dirty)
+        {
+            cache_unpin (slot, false);
+            continue;
+        }
+        if (slot->busy || slot->writer)
+        {
+            slots[deferred++] = slot;
+            continue;
+        }
+        slot->readers++;
+        while (i < cnt && i - start < WRITE_RUN_MAX
+               && slots[i]->disk_sector == slots[i - 1]->disk_sector + 1
+               && slots[i]->dirty && !slots[i]->busy && !slots[i]->writer)
+            slots[i++]->readers++;
+        cache_write_run (&slots[start], i - start);
+        for (j = start; j < i; j++)
+            cache_unpin (slots[j], false);
+    }
+    for (j = 0; j < deferred; j++)
+    {
+        cache_write_back (slots[j]);
+        cache_unpin (slots[j], false);
+    }
+}
+
+/* Returns a pinned entry holding SECTOR, of class CLASS, with
+   shared access for CACHE_READ and exclusive access otherwise.  On a miss, takes
+   over the entry chosen by cache_victim() and, unless INTENT
+   is CACHE_OVERWRITE, reads SECTOR into it without holding
+   cache_lock, so that hits and other misses proceed meanwhile. */
+static struct cache_entry *
+cache_acquire (block_sector_t sector, enum cache_class class,
+               enum cache_intent intent)
+{
+    bool exclusive = intent != CACHE_READ;
+    bool grow_failed = false;
+    struct cache_entry *slot;
+
+    lock_acquire (&cache_lock);
+    for (;;)
+    {
+        slot = cache_lookup (sector);
+        if (slot != NULL)
+        {
+            cache_stats[class].hits++;
+            cache_pin (slot);
+            cache_set_class (slot, class);
+            cache_wait_access (slot, exclusive);
+            break;
+        }
+
+        /* Rather than evict, grow while memory allows.  Growing
+           drops cache_lock, so SLOT may be stale afterward and
+           SECTOR may have been brought in: start over either way,
+           but evict rather than try palloc again if it failed. */
+        slot = cache_victim ();
+        if ((slot == NULL || slot->valid) && !grow_failed && !cache_growing
+            && slab_cnt < slab_limit)
+        {
+            grow_failed = !cache_grow (0);
+            continue;
+        }
+        if (slot == NULL)
+        {
+            cond_wait (&cache_unpinned, &cache_lock);
+            continue;
+        }
+        cache_pin (slot);
+        if (slot->valid && slot->dirty)
+        {
+            /* SECTOR may have been brought in by another thread
+               while we were writing, so look it up again. */
+            cache_write_back (slot);
+            cache_unpin (slot, true);
+            continue;
+        }
+
+        cache_assign (slot, sector, class);
+        cache_stats[class].misses++;
+
+        /* The caller replaces the whole sector, so there is no
+           point in reading the old contents. */
+        if (intent == CACHE_OVERWRITE)
+        {
+            cache_wait_access (slot, exclusive);
+            break;
+        }
+
+        if (intent == CACHE_WRITE)
+            cache_stats[class].read_before_writes++;
+        slot->busy = 1;
+        lock_release (&cache_lock);
         block_read (fs_device, sector, slot->buffer);
+        lock_acquire (&cache_lock);
+        slot->busy = 0;
+        cond_broadcast (&slot->access_cond, &cache_lock);
+        cache_wait_access (slot, exclusive);
+        break;
+    }
+    lock_release (&cache_lock);
+    return slot;
+}
+
+/* Gives up access to SLOT taken by cache_acquire(), marking it
+   dirty if DIRTY is true. */
+static void
+cache_release (struct cache_entry *slot, bool exclusive, bool dirty)
+{
+    lock_acquire (&cache_lock);
+    if (exclusive)
+        slot->writer = 0;
+    else
+        slot->readers--;
+    if (dirty && !slot->dirty)
+    {
+        slot->dirty = 1;
+        cache_link_dirty (slot);
+        cache_dirty_cnt++;
+        if (cache_dirty_ratio > 0
+            && cache_dirty_cnt * 100 >= cache_cnt * cache_dirty_ratio)
+            flush_requested = 1;
+    }
+    else if (dirty && (slot->dirty_owner == NULL
+                       || slot->dirty_owner->inode_sector != slot->owner))
+    {
+        /* Dirtied again on behalf of another inode. */
+        cache_unlink_dirty (slot);
+        cache_link_dirty (slot);
     }
-    slot->recent_used = 0;
-    list_sort (&cache_list, cache_recent_used_more, NULL);
+    cond_broadcast (&slot->access_cond, &cache_lock);
+    cache_unpin (slot, false);
+    lock_release (&cache_lock);
+}
+
+/* Pins SECTOR, which holds a block of CLASS, in the cache and
+   returns its entry, whose data may then be used in place
+   through cache_buffer() until the entry is handed back with
+   cache_put().  INTENT tells whether the caller only reads the
+   data, sharing it with other readers, or needs exclusive access
+   to modify it.  With CACHE_OVERWRITE the data is garbage on
+   return and the caller must overwrite all of it and put the
+   entry back dirty. */
+struct cache_entry *
+cache_get (block_sector_t sector, enum cache_class class,
+           enum cache_intent intent)
+{
+    return cache_acquire (sector, class, intent);
+}
+
+/* Returns the BLOCK_SECTOR_SIZE bytes of data cached in SLOT,
+   which must have been obtained with cache_get(). */
+void *
+cache_buffer (struct cache_entry *slot)
+{
+    ASSERT (slot->pin_cnt > 0);
+    return slot->buffer;
+}
+
+/* Records that the data in SLOT, obtained with cache_get() for
+   writing, belongs to the inode at INODE_SECTOR, so that
+   cache_flush_owner() for that inode writes it back. */
+void
+cache_set_owner (struct cache_entry *slot, block_sector_t inode_sector)
+{
+    ASSERT (slot->writer);
+    slot->owner = inode_sector;
+}
+
+/* Unpins SLOT, obtained with cache_get().  DIRTY must be true if
+   the caller modified the data, which requires CACHE_WRITE. */
+void
+cache_put (struct cache_entry *slot, bool dirty)
+{
+    ASSERT (!dirty || slot->writer);
+    cache_release (slot, slot->writer, dirty);
+}
+
+void
+cache_read (block_sector_t sector, enum cache_class class, void *target)
+{
+    struct cache_entry *slot = cache_get (sector, class, CACHE_READ);
     memcpy (target, slot->buffer, BLOCK_SECTOR_SIZE);
-    lock_release (&global_lock);
+    cache_put (slot, false);
 }
 
 void
-cache_write (block_sector_t sector, const void *source)
+cache_write (block_sector_t sector, enum cache_class class,
+             block_sector_t owner, const void *source)
 {
-    lock_acquire (&global_lock);
-    struct cache_entry *slot = cache_lookup (sector);
-    if (slot == NULL)
+    cache_write_at (sector, class, owner, source, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from SOURCE into SECTOR at byte OFFSET, on
+   behalf of the inode at OWNER.  Only a partial update needs the
+   old contents of SECTOR. */
+void
+cache_write_at (block_sector_t sector, enum cache_class class,
+                block_sector_t owner, const void *source,
+                off_t offset, off_t size)
+{
+    ASSERT (offset >= 0 && size >= 0 && offset + size <= BLOCK_SECTOR_SIZE);
+    enum cache_intent intent = size == BLOCK_SECTOR_SIZE ? CACHE_OVERWRITE : CACHE_WRITE;
+    struct cache_entry *slot = cache_get (sector, class, intent);
+    memcpy (slot->buffer + offset, source, size);
+    cache_set_owner (slot, owner);
+    cache_put (slot, true);
+}
+
+/* Brings SECTOR into the cache without copying it anywhere. */
+void
+cache_prefetch (block_sector_t sector, enum cache_class class)
+{
+    cache_put (cache_get (sector, class, CACHE_READ), false);
+}
+
+/* Makes SECTOR, if it is cached and not in use, the next entry
+   of its queue to be evicted. */
+void
+cache_demote (block_sector_t sector)
+{
+    struct cache_entry *slot;
+
+    lock_acquire (&cache_lock);
+    slot = cache_lookup (sector);
+    if (slot != NULL && slot->pin_cnt == 0)
     {
-        slot = cache_evcit ();
-        slot->valid = 1;
-        slot->dirty = 0;
-        slot->disk_sector = sector;
-        block_read (fs_device, sector, slot->buffer);
+        list_remove (&slot->elem);
+        list_push_back (cache_queue (slot), &slot->elem);
+    }
+    lock_release (&cache_lock);
+}
+
+/* Writes every dirty entry back to disk.  If WAIT is false,
+   entries that are currently being modified are skipped instead
+   of waited for. */
+static void
+cache_flush_entries (bool wait)
+{
+    struct cache_entry **slots;
+    size_t max, cnt = 0;
+    struct list_elem *e;
+
+    lock_acquire (&cache_lock);
+    max = cache_dirty_cnt;
+    slots = max > 0 ? malloc (max * sizeof *slots) : NULL;
+    for (e = list_begin (&slab_list); e != list_end (&slab_list); e = list_next (e))
+    {
+        struct cache_slab *slab = list_entry (e, struct cache_slab, elem);
+        for (size_t i = 0; i < SLAB_SECTORS; i++)
+        {
+            /* Pinning SLOT keeps its slab from being dropped while
+               cache_lock is released for the write. */
+            struct cache_entry *slot = &slab->entries[i];
+            if (!slot->valid || !slot->dirty) continue;
+            if (!wait && (slot->busy || slot->writer)) continue;
+            cache_pin (slot);
+            if (slots != NULL && cnt < max)
+                slots[cnt++] = slot;
+            else
+                cache_write_sorted (&slot, 1);
+        }
+    }
+    if (slots != NULL)
+    {
+        cache_write_sorted (slots, cnt);
+        free (slots);
+    }
+    lock_release (&cache_lock);
+}
+
+/* Writes back the entries that were dirty on entry and belong
+   to the inode at INODE_SECTOR. */
+void
+cache_flush_owner (block_sector_t inode_sector)
+{
+    struct cache_owner *o;
+    size_t cnt;
+
+    struct cache_entry **slots;
+    struct list_elem *e;
+
+    lock_acquire (&cache_lock);
+    o = owner_lookup (inode_sector);
+    cnt = o != NULL ? list_size (&o->dirty) : 0;
+    slots = cnt > 0 ? malloc (cnt * sizeof *slots) : NULL;
+    if (slots != NULL)
+    {
+        size_t i = 0;
+        for (e = list_begin (&o->dirty); e != list_end (&o->dirty); e = list_next (e))
+        {
+            slots[i] = list_entry (e, struct cache_entry, dirty_elem);
+            cache_pin (slots[i++]);
+        }
+        cache_write_sorted (slots, cnt);
+        free (slots);
+    }
+    else
+    {
+        /* Entries dirtied meanwhile go to the back of the list, so
+           stopping after CNT writes cannot miss an older one. */
+        while (cnt-- > 0 && (o = owner_lookup (inode_sector)) != NULL)
+        {
+            struct cache_entry *slot = list_entry (list_front (&o->dirty),
+                                                   struct cache_entry, dirty_elem);
+            cache_pin (slot);
+            cache_write_back (slot);
+            cache_unpin (slot, false);
+        }
     }
-    slot->recent_used = 0;
-    slot->dirty = 1;
-    list_sort (&cache_list, cache_recent_used_more, NULL);
-    memcpy (slot->buffer, source, BLOCK_SECTOR_SIZE);
-    lock_release (&global_lock);
+    lock_release (&cache_lock);
+}
+
+/* Writes all dirty entries back to disk. */
+void
+cache_flush (void)
+{
+    cache_flush_entries (true);
 }
 
 void
 cache_close (void)
 {
-    lock_acquire (&global_lock);
-    for (size_t i = 0; i < CACHE_SIZE; i++)
+    cache_flush_entries (true);
+}
+
+/* Copies the activity counters for each class into STATS. */
+void
+cache_get_stats (struct cache_stat stats[CACHE_CLASS_CNT])
+{
+    lock_acquire (&cache_lock);
+    memcpy (stats, cache_stats, sizeof cache_stats);
+    lock_release (&cache_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+    static const char *class_names[CACHE_CLASS_CNT] =
+        {"inode", "index", "directory", "file data", "free map"};
+
+    for (int i = 0; i < CACHE_CLASS_CNT; i++)
     {
-        if (!cache[i].valid) continue;
-        if (cache[i].dirty)
-            block_write (fs_device, cache[i].disk_sector, cache[i].buffer);
+        const struct cache_stat *st = &cache_stats[i];
+        printf ("Cache (%s): %llu hits, %llu misses, %llu evictions, "
+                "%llu write-backs, %llu reads before write\n",
+                class_names[i], st->hits, st->misses, st->evictions,
+                st->write_backs, st->read_before_writes);
     }
-    lock_release (&global_lock);
+}
+
+/* Write-behind thread.  Writes dirty entries back every
+   cache_flush_interval milliseconds, or sooner when the share
+   of dirty entries reaches cache_dirty_ratio, so that eviction
+   and foreground writers rarely have to wait for a write. */
+static void
+cache_flush_daemon (void *aux UNUSED)
+{
+    int64_t last_flush = timer_ticks ();
+    for (;;)
+    {
+        int64_t interval = (int64_t) cache_flush_interval * TIMER_FREQ / 1000;
+
+        timer_sleep (FLUSH_POLL_TICKS);
+        if (flush_requested
+            || (cache_flush_interval > 0 && timer_elapsed (last_flush) >= interval))
+        {
+            flush_requested = 0;
+            cache_flush_entries (false);
+            last_flush = timer_ticks ();
+        }
+    }
+}
+
+static unsigned
+cache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct cache_entry *ce = hash_entry (e, struct cache_entry, hash_elem);
+  return hash_int (ce->disk_sector);
 }
 
 static bool
-cache_recent_used_more (const struct list_elem *lhs, const struct list_elem *rhs, void *aux UNUSED)
+cache_less (const struct hash_elem *lhs, const struct hash_elem *rhs, void *aux UNUSED)
 {
-  struct cache_entry *a, *b;
-  
+  const struct cache_entry *a, *b;
+
   ASSERT (lhs != NULL && rhs != NULL);
-  
-  a = list_entry (lhs, struct cache_entry, elem);
-  b = list_entry (rhs, struct cache_entry, elem);
-  
-  return (a->recent_used > b->recent_used);
+
+  a = hash_entry (lhs, struct cache_entry, hash_elem);
+  b = hash_entry (rhs, struct cache_entry, hash_elem);
+
+  return a->disk_sector < b->disk_sector;
+}
+
+static unsigned
+ghost_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct cache_ghost *g = hash_entry (e, struct cache_ghost, hash_elem);
+  return hash_int (g->disk_sector);
+}
+
+static bool
+ghost_less (const struct hash_elem *lhs, const struct hash_elem *rhs, void *aux UNUSED)
+{
+  const struct cache_ghost *a, *b;
+
+  ASSERT (lhs != NULL && rhs != NULL);
+
+  a = hash_entry (lhs, struct cache_ghost, hash_elem);
+  b = hash_entry (rhs, struct cache_ghost, hash_elem);
+
+  return a->disk_sector < b->disk_sector;
+}
+
+static unsigned
+owner_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct cache_owner *o = hash_entry (e, struct cache_owner, hash_elem);
+  return hash_int (o->inode_sector);
+}
+
+static bool
+owner_less (const struct hash_elem *lhs, const struct hash_elem *rhs, void *aux UNUSED)
+{
+  const struct cache_owner *a, *b;
+
+  ASSERT (lhs != NULL && rhs != NULL);
+
+  a = hash_entry (lhs, struct cache_owner, hash_elem);
+  b = hash_entry (rhs, struct cache_owner, hash_elem);
+
+  return a->inode_sector < b->inode_sector;
 }
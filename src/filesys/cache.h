@@ -1,11 +1,64 @@
 #ifndef FILESYS_CACHE_H
 #define FILESYS_CACHE_H
 
+#include <stdbool.h>
+#include <cache-stat.h>
 #include "devices/block.h"
+#include "filesys/off_t.h"
 
+/* Write-behind tuning.
+   Controlled by kernel command-line options "-wb-interval" and
+   "-wb-ratio". */
+extern unsigned cache_flush_interval;   /* Milliseconds, 0 to disable. */
+extern unsigned cache_dirty_ratio;      /* Percent dirty, 0 to disable. */
+
+/* Replacement policy.
+   Controlled by kernel command-line option "-cache-policy". */
+enum cache_policy
+  {
+    CACHE_LRU,                  /* Least recently used. */
+    CACHE_2Q                    /* 2Q, which resists sequential scans. */
+  };
+extern enum cache_policy cache_policy;
+
+/* Most pages of memory the cache may grow to, 0 for a default
+   that scales with RAM.
+   Controlled by kernel command-line option "-cache-max". */
+extern unsigned cache_max_pages;
+
+/* How a caller of cache_get() intends to use a block. */
+enum cache_intent
+  {
+    CACHE_READ,                 /* Shared access, for reading. */
+    CACHE_WRITE,                /* Exclusive access, for modifying. */
+    CACHE_OVERWRITE             /* Exclusive access, for replacing all
+                                   data without reading it first. */
+  };
+
+struct cache_entry;
+
+/* Owner of blocks that belong to no inode. */
+#define CACHE_NO_OWNER ((block_sector_t) -1)
+
+void cache_set_policy (const char *name);
 void cache_init (void);
-void cache_read (block_sector_t sector, void *target);
-void cache_write (block_sector_t sector, const void *source);
+struct cache_entry *cache_get (block_sector_t sector, enum cache_class,
+                              enum cache_intent);
+void *cache_buffer (struct cache_entry *);
+void cache_set_owner (struct cache_entry *, block_sector_t inode_sector);
+void cache_put (struct cache_entry *, bool dirty);
+void cache_read (block_sector_t sector, enum cache_class, void *target);
+void cache_write (block_sector_t sector, enum cache_class,
+                  block_sector_t owner, const void *source);
+void cache_write_at (block_sector_t sector, enum cache_class,
+                     block_sector_t owner, const void *source,
+                     off_t offset, off_t size);
+void cache_prefetch (block_sector_t sector, enum cache_class);
+void cache_demote (block_sector_t sector);
+void cache_flush_owner (block_sector_t inode_sector);
+void cache_flush (void);
 void cache_close (void);
+void cache_get_stats (struct cache_stat stats[CACHE_CLASS_CNT]);
+void cache_print_stats (void);
 
-#endif /* filesys/cache.h */
\ No newline at end of file
+#endif /* filesys/cache.h */
@@ -0,0 +1,327 @@
+#include "filesys/extent.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/free-map.h"
+
+/* A node of an extent tree other than the root.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_node
+  {
+    uint16_t depth;                     /* 0 if entries are extents. */
+    uint16_t cnt;                       /* Number of entries in use. */
+    struct extent entries[EXTENT_NODE_CNT];
+    uint32_t unused;
+  };
+
+/* Returns the position of the last of the CNT ENTRIES, sorted by
+   index, that starts at or before INDEX, or -1 if there is none. */
+static int
+find_entry (const struct extent *entries, int cnt, uint32_t index)
+{
+  int lo = 0, hi = cnt;
+
+  while (lo < hi)
+    {
+      int mid = (lo + hi) / 2;
+      if (entries[mid].index <= index)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo - 1;
+}
+
+/* Stores into *E the blocks of the file mapped by ROOT from block
+   INDEX up to the end of the extent that holds it, and returns
+   true.  If block INDEX is not mapped, returns false and sets
+   E->count to the number of blocks from INDEX that are not mapped
+   either, or to 0 if no later block is mapped. */
+bool
+extent_lookup (const struct extent_root *root, uint32_t index,
+               struct extent *e)
+{
+  const struct extent *entries = root->entries;
+  int cnt = root->cnt, depth = root->depth;
+  struct cache_entry *block = NULL;
+  uint32_t limit = root->end;
+  bool found = false;
+
+  e->index = index;
+  e->start = 0;
+  e->count = 0;
+  if (index >= root->end)
+    return false;
+  for (;;)
+    {
+      int i = find_entry (entries, cnt, index);
+      block_sector_t child;
+      const struct extent_node *node;
+
+      if (i + 1 < cnt && entries[i + 1].index < limit)
+        limit = entries[i + 1].index;
+      if (i < 0)
+        break;
+      if (depth == 0)
+        {
+          uint32_t skip = index - entries[i].index;
+          if (skip < entries[i].count)
+            {
+              e->start = entries[i].start + skip;
+              e->count = entries[i].count - skip;
+              found = true;
+            }
+          break;
+        }
+
+      /* Descend, holding at most one node at a time. */
+      child = entries[i].start;
+      if (block != NULL)
+        cache_put (block, false);
+      block = cache_get (child, CACHE_INDEX, CACHE_READ);
+      node = cache_buffer (block);
+      entries = node->entries;
+      cnt = node->cnt;
+      depth = node->depth;
+    }
+  if (block != NULL)
+    cache_put (block, false);
+  if (!found)
+    e->count = limit - index;
+  return found;
+}
+
+/* Extends extent LAST by E and returns true, if E continues LAST
+   both in the file and on disk.  Otherwise returns false. */
+static bool
+extent_merge (struct extent *last, const struct extent *e)
+{
+  if (last->index + last->count != e->index
+      || last->start + last->count != e->start)
+    return false;
+  last->count += e->count;
+  return true;
+}
+
+/* Most nodes one insertion can add: one per level of a tree of
+   the greatest depth a file can need, plus one for a new root. */
+#define SPARE_MAX 8
+
+/* Sectors set aside before an insertion for the nodes it may
+   split, so that it cannot fail halfway through. */
+struct spares
+  {
+    block_sector_t sectors[SPARE_MAX];
+    int cnt;
+  };
+
+/* Creates a node at DEPTH holding the CNT ENTRIES, in a sector
+   taken from SPARES, on behalf of the inode at OWNER.  Returns
+   its sector. */
+static block_sector_t
+node_create (struct spares *spares, uint16_t depth,
+             const struct extent *entries, uint16_t cnt, block_sector_t owner)
+{
+  struct cache_entry *block;
+  struct extent_node *node;
+  block_sector_t sector;
+
+  ASSERT (sizeof *node == BLOCK_SECTOR_SIZE);
+  ASSERT (cnt > 0 && cnt <= EXTENT_NODE_CNT);
+  ASSERT (spares->cnt > 0);
+
+  sector = spares->sectors[--spares->cnt];
+  block = cache_get (sector, CACHE_INDEX, CACHE_OVERWRITE);
+  node = cache_buffer (block);
+  memset (node, 0, sizeof *node);
+  node->depth = depth;
+  node->cnt = cnt;
+  memcpy (node->entries, entries, cnt * sizeof *entries);
+  cache_set_owner (block, owner);
+  cache_put (block, true);
+  return sector;
+}
+
+static bool node_insert (block_sector_t sector, const struct extent *e,
+                         block_sector_t owner, struct spares *spares,
+                         struct extent *split);
+
+/* Inserts E into the *CNT ENTRIES of a node at DEPTH, which has
+   room for MAX entries, or into the subtree below the entry that
+   covers it.  If the node is full, it keeps the lower half of its
+   entries and a new node at the same depth gets the upper half;
+   *SPLIT is then set to an entry for the new node, and otherwise
+   its START to 0.  Returns true if ENTRIES changed. */
+static bool
+insert_entry (struct extent *entries, uint16_t *cnt, int max, int depth,
+              const struct extent *e, block_sector_t owner,
+              struct spares *spares, struct extent *split)
+{
+  struct extent add = *e;
+  struct extent all[EXTENT_NODE_CNT + 1];
+  int i = find_entry (entries, *cnt, e->index);
+  int pos, left;
+  bool changed = false;
+
+  split->start = 0;
+  if (depth > 0)
+    {
+      /* Below the first child's key, lower the key to E. */
+      if (i < 0)
+        {
+          i = 0;
+          entries[0].index = e->index;
+          changed = true;
+        }
+      if (!node_insert (entries[i].start, e, owner, spares, &add))
+        return changed;
+    }
+  else if (i >= 0 && extent_merge (&entries[i], e))
+    {
+      /* E may also close the gap to the next extent. */
+      if (i + 1 < *cnt && extent_merge (&entries[i], &entries[i + 1]))
+        {
+          memmove (&entries[i + 1], &entries[i + 2],
+                   (*cnt - i - 2) * sizeof *entries);
+          (*cnt)--;
+        }
+      return true;
+    }
+  else if (i + 1 < *cnt && extent_merge (&add, &entries[i + 1]))
+    {
+      entries[i + 1] = add;
+      return true;
+    }
+
+  /* Put ADD right after entry I. */
+  pos = i + 1;
+  if (*cnt < max)
+    {
+      memmove (&entries[pos + 1], &entries[pos], (*cnt - pos) * sizeof *entries);
+      entries[pos] = add;
+      (*cnt)++;
+      return true;
+    }
+
+  /* Split the node. */
+  memcpy (all, entries, pos * sizeof *entries);
+  all[pos] = add;
+  memcpy (&all[pos + 1], &entries[pos], (*cnt - pos) * sizeof *entries);
+  left = (*cnt + 1) / 2;
+  memcpy (entries, all, left * sizeof *entries);
+  split->index = all[left].index;
+  split->start = node_create (spares, depth, &all[left], *cnt + 1 - left,
+                              owner);
+  split->count = 0;
+  *cnt = left;
+  return true;
+}
+
+/* Inserts E into the subtree rooted at SECTOR, as described for
+   insert_entry().  Returns true if the node split, with *SPLIT
+   set to an entry for the new node. */
+static bool
+node_insert (block_sector_t sector, const struct extent *e,
+             block_sector_t owner, struct spares *spares,
+             struct extent *split)
+{
+  struct cache_entry *block = cache_get (sector, CACHE_INDEX, CACHE_WRITE);
+  struct extent_node *node = cache_buffer (block);
+  bool changed;
+
+  changed = insert_entry (node->entries, &node->cnt, EXTENT_NODE_CNT,
+                          node->depth, e, owner, spares, split);
+  if (changed)
+    cache_set_owner (block, owner);
+  cache_put (block, changed);
+  return split->start != 0;
+}
+
+/* Maps the COUNT blocks of a file from block INDEX on, none of
+   which ROOT maps yet, to the consecutive sectors from START, on
+   behalf of the inode at OWNER.  Merges them into the extents
+   around them where possible.  Returns false if the disk is too
+   full for the tree nodes the insertion may need, in which case
+   the caller still owns the sectors. */
+bool
+extent_insert (struct extent_root *root, uint32_t index,
+               block_sector_t start, uint32_t count, block_sector_t owner)
+{
+  struct spares spares;
+  struct extent e, split;
+  bool success = true;
+
+  ASSERT (sizeof *root == 500);
+  ASSERT (count > 0);
+  ASSERT (root->depth + 2 <= SPARE_MAX);
+
+  /* Set aside a sector for every node that could split, and for
+     a new root. */
+  for (spares.cnt = 0; spares.cnt < root->depth + 2; spares.cnt++)
+    if (!free_map_allocate (1, &spares.sectors[spares.cnt]))
+      {
+        success = false;
+        goto done;
+      }
+
+  e.index = index;
+  e.start = start;
+  e.count = count;
+  split.start = 0;
+  if (root->cnt == 0)
+    root->entries[root->cnt++] = e;
+  else
+    insert_entry (root->entries, &root->cnt, EXTENT_ROOT_CNT, root->depth,
+                  &e, owner, &spares, &split);
+  if (split.start != 0)
+    {
+      /* Move the root's lower half down into a new node and make
+         the tree one level deeper. */
+      struct extent lower;
+
+      lower.index = root->entries[0].index;
+      lower.start = node_create (&spares, root->depth, root->entries,
+                                 root->cnt, owner);
+      lower.count = 0;
+      root->depth++;
+      root->cnt = 2;
+      root->entries[0] = lower;
+      root->entries[1] = split;
+    }
+  if (root->end < index + count)
+    root->end = index + count;
+
+ done:
+  while (spares.cnt > 0)
+    free_map_release (spares.sectors[--spares.cnt], 1);
+  return success;
+}
+
+/* Releases the CNT ENTRIES of a node at DEPTH, along with the
+   sectors they map. */
+static void
+free_entries (const struct extent *entries, int cnt, int depth)
+{
+  int i;
+
+  for (i = 0; i < cnt; i++)
+    if (depth == 0)
+      free_map_release (entries[i].start, entries[i].count);
+    else
+      {
+        struct cache_entry *block = cache_get (entries[i].start, CACHE_INDEX,
+                                               CACHE_READ);
+        const struct extent_node *node = cache_buffer (block);
+        free_entries (node->entries, node->cnt, node->depth);
+        cache_put (block, false);
+        free_map_release (entries[i].start, 1);
+      }
+}
+
+/* Releases every sector mapped by ROOT, and the nodes of its
+   tree.  ROOT itself is left as it is. */
+void
+extent_free (const struct extent_root *root)
+{
+  free_entries (root->entries, root->cnt, root->depth);
+}
@@ -0,0 +1,41 @@
+#ifndef FILESYS_EXTENT_H
+#define FILESYS_EXTENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "devices/block.h"
+
+/* COUNT blocks of a file, from block INDEX on, stored in
+   consecutive sectors from START.  In an interior node of an
+   extent tree, START is instead the sector of the child node
+   that maps the blocks from INDEX on, and COUNT is unused. */
+struct extent
+  {
+    uint32_t index;                     /* First block of the file. */
+    block_sector_t start;               /* First sector, or child node. */
+    uint32_t count;                     /* Number of blocks. */
+  };
+
+/* Number of entries in the root of an extent tree, which lives in
+   the inode, and in every other node, which fills a sector. */
+#define EXTENT_ROOT_CNT 41
+#define EXTENT_NODE_CNT 42
+
+/* Root of an extent tree.  Exactly 500 bytes long, so that it
+   fits in an on-disk inode. */
+struct extent_root
+  {
+    uint16_t depth;                     /* 0 if entries are extents. */
+    uint16_t cnt;                       /* Number of entries in use. */
+    uint32_t end;                       /* Block after the last mapped. */
+    struct extent entries[EXTENT_ROOT_CNT];
+  };
+
+bool extent_lookup (const struct extent_root *, uint32_t index,
+                    struct extent *);
+bool extent_insert (struct extent_root *, uint32_t index,
+                    block_sector_t start, uint32_t count,
+                    block_sector_t owner);
+void extent_free (const struct extent_root *);
+
+#endif /* filesys/extent.h */
@@ -1,16 +1,31 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include <round.h>
 #include "filesys/inode.h"
+#include "devices/block.h"
 #include "threads/malloc.h"
 
+/* Read-ahead window bounds, in bytes. */
+#define READAHEAD_MIN (4 * BLOCK_SECTOR_SIZE)
+#define READAHEAD_MAX (16 * BLOCK_SECTOR_SIZE)
+
+/* Read-ahead window for files advised ADVISE_SEQUENTIAL. */
+#define READAHEAD_SEQUENTIAL (64 * BLOCK_SECTOR_SIZE)
+
 /* An open file. */
 struct file
   {
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ra_next;              /* Where a sequential read would start. */
+    off_t ra_end;               /* End of data already read ahead. */
+    off_t ra_window;            /* Read-ahead window, 0 if not sequential. */
+    enum advise_hint advice;    /* Expected access pattern. */
   };
 
+static void file_readahead (struct file *, off_t pos, off_t size);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +38,10 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
+      file->advice = ADVISE_NORMAL;
       return file;
     }
   else
@@ -69,10 +88,59 @@ off_t
 file_read (struct file *file, void *buffer, off_t size)
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  file_readahead (file, file->pos, bytes_read);
+
+  /* Data read sequentially will not be wanted again. */
+  if (file->advice == ADVISE_SEQUENTIAL && bytes_read > 0)
+    {
+      off_t start = ROUND_DOWN (file->pos, BLOCK_SECTOR_SIZE);
+      off_t end = ROUND_DOWN (file->pos + bytes_read, BLOCK_SECTOR_SIZE);
+      if (start < end)
+        inode_dontneed (file->inode, start, end - start);
+    }
   file->pos += bytes_read;
   return bytes_read;
 }
 
+/* Called after SIZE bytes were read from FILE at POS.  Once reads
+   are seen to continue where the previous one stopped, reads ahead
+   of them in the background, doubling the window on each further
+   sequential read.  Advice overrides this guesswork: a file
+   advised ADVISE_SEQUENTIAL is always read ahead, by a larger
+   window, and one advised ADVISE_RANDOM never is. */
+static void
+file_readahead (struct file *file, off_t pos, off_t size)
+{
+  bool sequential = pos == file->ra_next;
+  off_t start, end;
+
+  if (size <= 0 || file->advice == ADVISE_RANDOM)
+    return;
+  file->ra_next = pos + size;
+  if (!sequential)
+    file->ra_end = 0;
+
+  if (file->advice == ADVISE_SEQUENTIAL)
+    file->ra_window = READAHEAD_SEQUENTIAL;
+  else if (!sequential)
+    {
+      file->ra_window = 0;
+      return;
+    }
+  else if (file->ra_window == 0)
+    file->ra_window = READAHEAD_MIN;
+  else if (file->ra_window < READAHEAD_MAX)
+    file->ra_window *= 2;
+
+  start = file->ra_end > file->ra_next ? file->ra_end : file->ra_next;
+  end = file->ra_next + file->ra_window;
+  if (start < end)
+    {
+      inode_readahead (file->inode, start, end - start);
+      file->ra_end = end;
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually read,
@@ -155,6 +223,11 @@ file_seek (struct file *file, off_t new_pos)
 {
   ASSERT (file != NULL);
   ASSERT (new_pos >= 0);
+
+  /* What was read ahead of the old position says nothing about
+     the new one. */
+  if (new_pos != file->pos)
+    file->ra_end = 0;
   file->pos = new_pos;
 }
 
@@ -166,3 +239,42 @@ file_tell (struct file *file)
   ASSERT (file != NULL);
   return file->pos;
 }
+
+/* Tells how FILE will be accessed.  ADVISE_WILLNEED and
+   ADVISE_DONTNEED apply to the LENGTH bytes starting at OFFSET,
+   or through end of file if LENGTH is 0.  The other hints apply
+   to all later reads through FILE and ignore the range.
+   ADVISE_WILLNEED reads the range into the cache before it
+   returns.  Returns false if HINT is not a valid hint. */
+bool
+file_advise (struct file *file, off_t offset, off_t length,
+             enum advise_hint hint)
+{
+  off_t left;
+
+  ASSERT (file != NULL);
+  ASSERT (offset >= 0 && length >= 0);
+  left = inode_length (file->inode) - offset;
+  if (length == 0 || length > left)
+    length = left;
+
+  switch (hint)
+    {
+    case ADVISE_NORMAL:
+    case ADVISE_SEQUENTIAL:
+    case ADVISE_RANDOM:
+      file->advice = hint;
+      file->ra_window = 0;
+      return true;
+    case ADVISE_WILLNEED:
+      if (length > 0)
+        inode_prefetch (file->inode, offset, length);
+      return true;
+    case ADVISE_DONTNEED:
+      if (length > 0)
+        inode_dontneed (file->inode, offset, length);
+      return true;
+    default:
+      return false;
+    }
+}
@@ -1,6 +1,8 @@
 #ifndef FILESYS_FILE_H
 #define FILESYS_FILE_H
 
+#include <advise.h>
+#include <stdbool.h>
 #include "filesys/off_t.h"
 
 struct inode;
@@ -26,4 +28,8 @@ void file_seek (struct file *, off_t);
 off_t file_tell (struct file *);
 off_t file_length (struct file *);
 
+/* Access pattern hints. */
+bool file_advise (struct file *, off_t offset, off_t length,
+                  enum advise_hint);
+
 #endif /* filesys/file.h */
@@ -8,12 +8,36 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "threads/synch.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* Block map layout of inodes created by do_format(). */
+static enum inode_layout format_layout = INODE_INDEXED;
+
+/* Serializes changes to directories and the lookups that resolve
+   paths through them, so that, for example, a file cannot be
+   removed while it is being opened.  Reading and writing files
+   does not take it. */
+static struct lock dir_lock;
+
 static void do_format (void);
 
+/* Sets the block map layout that formatting gives the file
+   system, by NAME: "indexed" or "extent".
+   Must be called before filesys_init(). */
+void
+filesys_set_layout (const char *name)
+{
+  if (name != NULL && !strcmp (name, "indexed"))
+    format_layout = INODE_INDEXED;
+  else if (name != NULL && !strcmp (name, "extent"))
+    format_layout = INODE_EXTENTS;
+  else
+    PANIC ("unknown file system layout `%s'", name != NULL ? name : "");
+}
+
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
 void
@@ -23,12 +47,22 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  lock_init (&dir_lock);
   inode_init ();
   free_map_init ();
   cache_init ();
 
   if (format)
     do_format ();
+  else
+    {
+      /* New inodes follow the layout of the root directory. */
+      struct inode *root = inode_open (ROOT_DIR_SECTOR);
+      if (root == NULL)
+        PANIC ("can't open root directory");
+      inode_set_default_layout (inode_get_layout (root));
+      inode_close (root);
+    }
 
   free_map_open ();
 }
@@ -57,16 +91,25 @@ filesys_create (const char *path, off_t initial_size, bool is_dir)
   char directory[strlen(path)];
   char name[strlen(path)];
   dir_parser (path, directory, name);
+  lock_acquire (&dir_lock);
   struct dir *dir = dir_open_path (directory);
 
+  /* Put a file's inode near its directory, and a directory's
+     where there is the most room for what will go in it. */
+  block_sector_t goal = 0;
+  if (dir != NULL)
+    goal = (is_dir ? free_map_dir_goal ()
+            : inode_get_inumber (dir_get_inode (dir)));
+
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && free_map_allocate_near (goal, 1, &inode_sector)
                   && inode_create (inode_sector, initial_size, is_dir)
                   && dir_add (dir, name, inode_sector, is_dir));
 
   if (!success && inode_sector != 0)
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  lock_release (&dir_lock);
 
   return success;
 }
@@ -85,11 +128,13 @@ filesys_open (const char *path)
   char directory[length + 1];
   char name[length + 1];
   dir_parser (path, directory, name);
+  lock_acquire (&dir_lock);
   struct dir *dir = dir_open_path (directory);
   struct inode *inode = NULL;
+  struct file *file = NULL;
 
   // removed directory handling
-  if (dir == NULL) return NULL;
+  if (dir == NULL) goto done;
 
   if (strlen(name) > 0) {
     dir_lookup (dir, name, &inode);
@@ -101,9 +146,13 @@ filesys_open (const char *path)
 
   // removed file handling
   if (inode == NULL || inode_is_removed (inode))
-    return NULL;
+    goto done;
+
+  file = file_open (inode);
 
-  return file_open (inode);
+ done:
+  lock_release (&dir_lock);
+  return file;
 }
 
 /* Deletes the file named NAME.
@@ -117,10 +166,12 @@ filesys_remove (const char *path)
   char directory[length + 1];
   char name[length + 1];
   dir_parser (path, directory, name);
+  lock_acquire (&dir_lock);
   struct dir *dir = dir_open_path (directory);
 
   bool success = (dir != NULL && dir_remove (dir, name));
   dir_close (dir);
+  lock_release (&dir_lock);
 
   return success;
 }
@@ -129,7 +180,9 @@ filesys_remove (const char *path)
 bool
 filesys_chdir (const char *name)
 {
+  lock_acquire (&dir_lock);
   struct dir *dir = dir_open_path (name);
+  lock_release (&dir_lock);
 
   if(dir == NULL) {
     return false;
@@ -145,6 +198,7 @@ static void
 do_format (void)
 {
   printf ("Formatting file system...");
+  inode_set_default_layout (format_layout);
   free_map_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
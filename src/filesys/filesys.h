@@ -11,6 +11,7 @@
 /* Block device that contains the file system. */
 struct block *fs_device;
 
+void filesys_set_layout (const char *name);
 void filesys_init (bool format);
 void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size, bool is_dir);
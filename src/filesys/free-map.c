@@ -1,22 +1,273 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* The sectors in use, as in free_map, together with those set
+   aside in a struct free_map_reserve, one bit per sector.
+   Searches for free sectors look here.  Only free_map is written
+   to disk, so sectors set aside are free again after a crash. */
+static struct bitmap *busy_map;
+
+/* Every struct free_map_reserve that holds sectors. */
+static struct list reserves;
+
+/* Sectors of the free map file that no longer match the free map,
+   one bit per sector, so that only those are written. */
+static struct bitmap *dirty_sectors;
+
+/* Number of bits of the free map held in one sector of its file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* The disk is divided into groups of GROUP_SECTORS sectors, whose
+   bits fill one sector of the free map file, and the number of
+   sectors in each group that are neither in use nor set aside is
+   kept, so that searches skip over groups that are full. */
+#define GROUP_SECTORS BITS_PER_SECTOR
+static size_t *group_free;           /* Free sectors in each group. */
+static size_t group_cnt;             /* Number of groups. */
+
+/* Sector where a search for free sectors without a goal starts:
+   the one after the last sectors allocated. */
+static block_sector_t next_fit;
+
+/* Serializes changes to the free map.  Held by a thread for the
+   whole of a batch. */
+static struct lock free_map_lock;
+
+/* Nesting depth of free_map_batch_begin() calls by the thread
+   holding free_map_lock.  While positive, changes to the free map
+   are only written at the end. */
+static int batch_depth;
+static bool batch_dirty;             /* Changed during the batch? */
+
+/* Acquires free_map_lock, unless the current thread already
+   holds it for a batch.  Returns true if it was acquired, in which
+   case the caller must release it. */
+static bool
+free_map_lock_acquire (void)
+{
+  if (lock_held_by_current_thread (&free_map_lock))
+    return false;
+  lock_acquire (&free_map_lock);
+  return true;
+}
+
+/* Notes that the CNT bits of the free map from SECTOR on
+   changed. */
+static void
+free_map_mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+  bitmap_set_multiple (dirty_sectors, first, last - first + 1, true);
+}
+
+/* Counts the free sectors in each group anew. */
+static void
+free_map_count_groups (void)
+{
+  size_t g;
+
+  for (g = 0; g < group_cnt; g++)
+    {
+      size_t start = g * GROUP_SECTORS;
+      size_t cnt = bitmap_size (busy_map) - start;
+      if (cnt > GROUP_SECTORS)
+        cnt = GROUP_SECTORS;
+      group_free[g] = bitmap_count (busy_map, start, cnt, false);
+    }
+}
+
+/* Marks the CNT sectors from SECTOR in busy_map as busy if BUSY
+   is true, or as free otherwise, keeping the group counts up to
+   date. */
+static void
+busy_set (block_sector_t sector, size_t cnt, bool busy)
+{
+  size_t end = sector + cnt;
+  size_t ofs;
+
+  bitmap_set_multiple (busy_map, sector, cnt, busy);
+  for (ofs = sector; ofs < end; )
+    {
+      size_t g = ofs / GROUP_SECTORS;
+      size_t group_end = (g + 1) * GROUP_SECTORS;
+      size_t n = (end < group_end ? end : group_end) - ofs;
+      if (busy)
+        group_free[g] -= n;
+      else
+        group_free[g] += n;
+      ofs += n;
+    }
+}
+
+/* Marks the CNT sectors from SECTOR in the free map as in use if
+   USED is true, or as free otherwise. */
+static void
+free_map_set (block_sector_t sector, size_t cnt, bool used)
+{
+  bitmap_set_multiple (free_map, sector, cnt, used);
+  free_map_mark_dirty (sector, cnt);
+}
+
+/* Returns true if a group of CNT free sectors could start in
+   group G, judging by the free sectors in G and in the groups
+   that such a run would reach into. */
+static bool
+group_may_fit (size_t g, size_t cnt)
+{
+  size_t reach = (g + 1) * GROUP_SECTORS - 1 + cnt;
+  size_t free_cnt = 0;
+  size_t h;
+
+  if (group_free[g] == 0)
+    return false;
+  for (h = g; h < group_cnt && h * GROUP_SECTORS < reach; h++)
+    free_cnt += group_free[h];
+  return free_cnt >= cnt;
+}
+
+/* Returns the first sector of a group of CNT free sectors, or
+   BITMAP_ERROR if there is none.  Searches from GOAL to the end
+   of the disk, then from the start of the disk, skipping the
+   groups that cannot hold such a run. */
+static block_sector_t
+free_map_search (block_sector_t goal, size_t cnt)
+{
+  size_t first = goal / GROUP_SECTORS;
+  size_t i;
+
+  for (i = 0; i <= group_cnt; i++)
+    {
+      size_t g = (first + i) % group_cnt;
+      size_t start = g * GROUP_SECTORS;
+      size_t end = start + GROUP_SECTORS;
+      size_t sector;
+
+      if (end > bitmap_size (busy_map))
+        end = bitmap_size (busy_map);
+      if (i == 0)
+        start = goal;
+      else if (i == group_cnt)
+        end = goal;
+      if (!group_may_fit (g, cnt))
+        continue;
+      sector = bitmap_scan_range (busy_map, start, end, cnt, false);
+      if (sector != BITMAP_ERROR)
+        return sector;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Gives back the sectors set aside in every struct
+   free_map_reserve.  Returns false if none were. */
+static bool
+free_map_drain (void)
+{
+  if (list_empty (&reserves))
+    return false;
+  while (!list_empty (&reserves))
+    {
+      struct free_map_reserve *r = list_entry (list_pop_front (&reserves),
+                                               struct free_map_reserve, elem);
+      busy_set (r->next, r->cnt, false);
+      r->cnt = 0;
+    }
+  return true;
+}
+
+/* Returns the first sector of a group of *CNT free sectors as
+   close after GOAL as possible.  If DOWN_TO_ONE is true and there
+   is no such group, tries for half as many sectors, and so on,
+   storing into *CNT the number found.  Takes back the sectors set
+   aside in every struct free_map_reserve before giving up.
+   Returns BITMAP_ERROR if the disk is full. */
+static block_sector_t
+free_map_find (block_sector_t goal, size_t *cnt, bool down_to_one)
+{
+  size_t want = *cnt;
+  block_sector_t sector = BITMAP_ERROR;
+
+  ASSERT (want > 0);
+
+  if (goal >= bitmap_size (busy_map))
+    goal = 0;
+  do
+    {
+      for (*cnt = want; *cnt > 0; *cnt = down_to_one ? *cnt / 2 : 0)
+        {
+          sector = free_map_search (goal, *cnt);
+          if (sector != BITMAP_ERROR)
+            return sector;
+        }
+    }
+  while (free_map_drain ());
+  return BITMAP_ERROR;
+}
+
+/* Writes the sectors of the free map that changed to its file,
+   or, inside a batch, notes that they must be written at the
+   end.  Sectors whose write fails stay marked for the next time.
+   Returns false if a write fails. */
+static bool
+free_map_persist (void)
+{
+  size_t start = 0;
+  bool success = true;
+
+  if (free_map_file == NULL)
+    return true;
+  if (batch_depth > 0)
+    {
+      batch_dirty = true;
+      return true;
+    }
+  while ((start = bitmap_scan (dirty_sectors, start, 1, true))
+         != BITMAP_ERROR)
+    {
+      size_t bit = start * BITS_PER_SECTOR;
+      size_t cnt = bitmap_size (free_map) - bit;
+      if (cnt > BITS_PER_SECTOR)
+        cnt = BITS_PER_SECTOR;
+      if (bitmap_write_range (free_map, free_map_file, bit, cnt))
+        bitmap_reset (dirty_sectors, start);
+      else
+        success = false;
+      start++;
+    }
+  return success;
+}
+
 /* Initializes the free map. */
 void
 free_map_init (void)
 {
+  lock_init (&free_map_lock);
+  list_init (&reserves);
   free_map = bitmap_create (block_size (fs_device));
-  if (free_map == NULL)
+  busy_map = bitmap_create (block_size (fs_device));
+  if (free_map == NULL || busy_map == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  dirty_sectors = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+                                               BITS_PER_SECTOR));
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (dirty_sectors == NULL || group_free == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (busy_map, FREE_MAP_SECTOR);
+  bitmap_mark (busy_map, ROOT_DIR_SECTOR);
+  free_map_count_groups ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -27,26 +278,190 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (next_fit, cnt, sectorp);
+}
+
+/* Allocates CNT consecutive sectors as free_map_allocate() does,
+   but taking the first run of free sectors at or after GOAL, or
+   failing that, the first one on the disk. */
+bool
+free_map_allocate_near (block_sector_t goal, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  bool locked = free_map_lock_acquire ();
+  block_sector_t sector = free_map_find (goal, &cnt, false);
+
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false);
-      sector = BITMAP_ERROR;
+      busy_set (sector, cnt, true);
+      free_map_set (sector, cnt, true);
+      if (!free_map_persist ())
+        {
+          free_map_set (sector, cnt, false);
+          busy_set (sector, cnt, false);
+          sector = BITMAP_ERROR;
+        }
     }
   if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+    {
+      *sectorp = sector;
+      next_fit = (sector + cnt) % bitmap_size (free_map);
+    }
+  if (locked)
+    lock_release (&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
+/* Returns a sector for the inode of a new directory to be
+   allocated near: the first sector of the group with the most
+   free sectors, so that directories, and the files kept near
+   them, spread out over the disk instead of crowding into its
+   first groups. */
+block_sector_t
+free_map_dir_goal (void)
+{
+  bool locked = free_map_lock_acquire ();
+  size_t best = 0;
+  size_t g;
+
+  for (g = 1; g < group_cnt; g++)
+    if (group_free[g] > group_free[best])
+      best = g;
+  if (locked)
+    lock_release (&free_map_lock);
+  return best * GROUP_SECTORS;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  bool locked = free_map_lock_acquire ();
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  free_map_set (sector, cnt, false);
+  busy_set (sector, cnt, false);
+  free_map_persist ();
+  if (locked)
+    lock_release (&free_map_lock);
+}
+
+/* Initializes R to hold no sectors. */
+void
+free_map_reserve_init (struct free_map_reserve *r)
+{
+  r->cnt = 0;
+}
+
+/* Allocates up to MAX consecutive sectors, at least one, from
+   those set aside in R, and stores the first into *SECTORP.  If
+   R holds none, first sets aside as many as WANT or MAX sectors,
+   whichever is more, as close after GOAL as possible, or fewer
+   if the disk has no run that long.  EXTRA more sectors are set
+   aside along with them only if they fit in the same run, so
+   that asking for them never breaks up the sectors that are
+   actually needed.  Sectors set aside are only
+   kept from other allocations while the free map is in memory,
+   and are taken back from R if the disk fills up.  Returns the
+   number of sectors allocated, or 0 if the disk is full or the
+   free_map file could not be written. */
+size_t
+free_map_take (struct free_map_reserve *r, block_sector_t goal,
+               size_t want, size_t extra, size_t max,
+               block_sector_t *sectorp)
+{
+  bool locked;
+  size_t cnt;
+
+  ASSERT (max > 0);
+
+  locked = free_map_lock_acquire ();
+  if (r->cnt == 0)
+    {
+      if (want < max)
+        want = max;
+      if (goal >= bitmap_size (busy_map))
+        goal = 0;
+      r->cnt = want + extra;
+      r->next = free_map_search (goal, r->cnt);
+      if (r->next == BITMAP_ERROR)
+        {
+          r->cnt = want;
+          r->next = free_map_find (goal, &r->cnt, true);
+        }
+      if (r->cnt > 0)
+        {
+          busy_set (r->next, r->cnt, true);
+          list_push_back (&reserves, &r->elem);
+        }
+    }
+  cnt = r->cnt < max ? r->cnt : max;
+  if (cnt > 0)
+    {
+      free_map_set (r->next, cnt, true);
+      if (free_map_persist ())
+        {
+          *sectorp = r->next;
+          r->next += cnt;
+          r->cnt -= cnt;
+          if (r->cnt == 0)
+            list_remove (&r->elem);
+          next_fit = r->next % bitmap_size (free_map);
+        }
+      else
+        {
+          free_map_set (r->next, cnt, false);
+          cnt = 0;
+        }
+    }
+  if (locked)
+    lock_release (&free_map_lock);
+  return cnt;
+}
+
+/* Gives back the sectors set aside in R, except for the first
+   KEEP of them. */
+void
+free_map_unreserve (struct free_map_reserve *r, size_t keep)
+{
+  bool locked = free_map_lock_acquire ();
+
+  if (r->cnt > keep)
+    {
+      busy_set (r->next + keep, r->cnt - keep, false);
+      r->cnt = keep;
+      if (r->cnt == 0)
+        list_remove (&r->elem);
+    }
+  if (locked)
+    lock_release (&free_map_lock);
+}
+
+/* Starts a batch of free map changes, which are written to disk
+   together by the matching free_map_batch_end() instead of one
+   at a time.  Batches may nest.  No other thread may change the
+   free map until the batch ends. */
+void
+free_map_batch_begin (void)
+{
+  free_map_lock_acquire ();
+  batch_depth++;
+}
+
+/* Ends a batch of free map changes, writing them to disk if this
+   ends the outermost batch. */
+void
+free_map_batch_end (void)
+{
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+  ASSERT (batch_depth > 0);
+  if (--batch_depth > 0)
+    return;
+  if (batch_dirty)
+    {
+      batch_dirty = false;
+      free_map_persist ();
+    }
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -56,8 +471,10 @@ free_map_open (void)
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_read (free_map, free_map_file))
+  if (!bitmap_read (free_map, free_map_file)
+      || !bitmap_read (busy_map, free_map_file))
     PANIC ("can't read free map");
+  free_map_count_groups ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -82,4 +499,5 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_sectors, false);
 }
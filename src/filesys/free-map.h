@@ -3,8 +3,19 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <list.h>
 #include "devices/block.h"
 
+/* Consecutive free sectors set aside for the use of one inode as
+   it grows, so that its blocks can be laid out one after another.
+   Owned by the free map while it holds sectors. */
+struct free_map_reserve
+  {
+    struct list_elem elem;      /* Element in the free map's list. */
+    block_sector_t next;        /* First sector set aside. */
+    size_t cnt;                 /* Number of sectors set aside. */
+  };
+
 void free_map_init (void);
 void free_map_read (void);
 void free_map_create (void);
@@ -12,6 +23,15 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_near (block_sector_t goal, size_t, block_sector_t *);
+void free_map_reserve_init (struct free_map_reserve *);
+size_t free_map_take (struct free_map_reserve *, block_sector_t goal,
+                      size_t want, size_t extra, size_t max,
+                      block_sector_t *);
+void free_map_unreserve (struct free_map_reserve *, size_t keep);
+block_sector_t free_map_dir_goal (void);
 void free_map_release (block_sector_t, size_t);
+void free_map_batch_begin (void);
+void free_map_batch_end (void);
 
 #endif /* filesys/free-map.h */
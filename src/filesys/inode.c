@@ -1,15 +1,27 @@
 #include "filesys/inode.h"
-#include <list.h>
 #include <debug.h>
+#include <hash.h>
 #include <round.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "filesys/cache.h"
+#include "filesys/extent.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
-/* Identifies an inode. */
+/* Identifies an inode, with an indexed or an extent block map or
+   with its data stored inline. */
 #define INODE_MAGIC 0x494e4f44
+#define INODE_EXTENT_MAGIC 0x494e4f45
+#define INODE_INLINE_MAGIC 0x494e4f49
+
+/* Most bytes of data an inode can hold inline, in place of its
+   block map. */
+#define INLINE_SIZE 500
 
 #define DIRECT_BLOCK_SIZE 122
 #define INDEX_SIZE 128
@@ -23,10 +35,24 @@ static char zeros[BLOCK_SECTOR_SIZE];
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    block_sector_t direct_blocks[DIRECT_BLOCK_SIZE];
-    block_sector_t first_index;
-    block_sector_t second_index;
-    block_sector_t third_index;
+    union
+      {
+        /* Block map of an INODE_MAGIC inode. */
+        struct
+          {
+            block_sector_t direct_blocks[DIRECT_BLOCK_SIZE];
+            block_sector_t first_index;
+            block_sector_t second_index;
+            block_sector_t third_index;
+          };
+
+        /* Block map of an INODE_EXTENT_MAGIC inode. */
+        struct extent_root extents;
+
+        /* Data of an INODE_INLINE_MAGIC inode.  Bytes past the
+           end of file are zero. */
+        uint8_t inline_data[INLINE_SIZE];
+      };
 
     bool is_dir;
     off_t length;                       /* File size in bytes. */
@@ -41,188 +67,657 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* Number of block runs remembered by each open inode. */
+#define MAP_CACHE_SIZE 4
+
+/* COUNT blocks of a file, starting at block INDEX, stored in
+   consecutive sectors starting at SECTOR. */
+struct block_run
+  {
+    off_t index;                        /* First block of the file. */
+    block_sector_t sector;              /* Sector holding it. */
+    off_t count;                        /* Number of blocks, 0 if unused. */
+  };
+
+/* Consecutive free sectors set aside while growing an inode, so
+   that its new blocks are laid out one after another.  They are
+   only marked in use on disk as they are mapped. */
+struct sector_pool
+  {
+    struct free_map_reserve reserve;    /* Sectors set aside. */
+    size_t want;                        /* Sectors still expected to be needed. */
+    size_t extra;                       /* Sectors to set aside beyond those. */
+    block_sector_t goal;                /* Where to look for more sectors. */
+    bool zero;                          /* Zero new data blocks? */
+  };
+
+/* Sectors an open inode sets aside past those it needs each time
+   it grows, so that a file written in small appends still gets
+   consecutive sectors. */
+#define PREALLOC_SECTORS 32
+
+/* In-memory inode.  Holds only what reading and writing need at
+   every turn; the rest of the on-disk inode, including its block
+   map, is looked up in the buffer cache when needed.  That keeps
+   it at about 240 bytes, within one of malloc()'s 256-byte
+   blocks, instead of the 700 or so it took with the whole disk
+   inode copied in. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    /* Protected by open_inodes_lock. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+
+    /* Held for reading to read the file's data, and for writing
+       to write or extend it or to change the fields below.  Never
+       held while touching user memory, since a page fault there
+       may read or write this same file. */
+    struct rwlock rwlock;
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
-    struct inode_disk data;             /* Inode content. */
+    off_t length;                       /* File size in bytes. */
+    bool is_dir;                        /* True if a directory. */
+    unsigned magic;                     /* Layout; changed under map_lock too. */
+
+    /* Recently translated block runs, so that reading or writing
+       a file does not walk its index blocks for every sector. */
+    struct lock map_lock;               /* Protects the fields below. */
+    struct block_run map[MAP_CACHE_SIZE];
+    int map_next;                       /* Entry to replace next. */
+    struct sector_pool prealloc;        /* Sectors set aside for growth. */
   };
 
-static block_sector_t index_to_sector (const struct inode_disk *inode_disk, off_t index);
-static bool inode_allocate (struct inode_disk *inode_disk, off_t length);
-static bool inode_allocate_index (block_sector_t *index, size_t sectors, off_t level);
-static void inode_deallocate (struct inode *inode, off_t length);
-static void inode_deallocate_index (block_sector_t index, size_t sectors, off_t level);
+/* Returns the cache class of the data of the inode at SECTOR. */
+static enum cache_class
+data_class (block_sector_t sector, bool is_dir)
+{
+  if (sector == FREE_MAP_SECTOR)
+    return CACHE_FREE_MAP;
+  return is_dir ? CACHE_DIR : CACHE_DATA;
+}
+
+static inline enum cache_class
+inode_data_class (const struct inode *inode)
+{
+  return data_class (inode->sector, inode->is_dir);
+}
+
+/* Returns true if INODE_DISK maps its blocks with extents. */
+static inline bool
+uses_extents (const struct inode_disk *inode_disk)
+{
+  return inode_disk->magic == INODE_EXTENT_MAGIC;
+}
+
+/* Returns true if INODE_DISK holds its data inline. */
+static inline bool
+is_inline (const struct inode_disk *inode_disk)
+{
+  return inode_disk->magic == INODE_INLINE_MAGIC;
+}
 
+/* Gets INODE's on-disk inode from the buffer cache for INTENT,
+   storing the cache entry holding it into *BLOCK, to be released
+   with disk_put(). */
+static struct inode_disk *
+disk_get (const struct inode *inode, enum cache_intent intent,
+          struct cache_entry **block)
+{
+  *block = cache_get (inode->sector, CACHE_INODE, intent);
+  return cache_buffer (*block);
+}
+
+/* Releases BLOCK, which holds INODE's on-disk inode, marking it
+   dirty if DIRTY is true. */
+static void
+disk_put (const struct inode *inode, struct cache_entry *block, bool dirty)
+{
+  if (dirty)
+    cache_set_owner (block, inode->sector);
+  cache_put (block, dirty);
+}
+
+/* Block map layout given to new inodes. */
+static enum inode_layout default_layout;
+
+/* Returns the magic number of an inode with a block map in the
+   default layout. */
+static inline unsigned
+default_magic (void)
+{
+  return default_layout == INODE_EXTENTS ? INODE_EXTENT_MAGIC : INODE_MAGIC;
+}
+
+static bool inode_allocate (struct inode_disk *inode_disk, off_t from, off_t to,
+                            enum cache_class class, block_sector_t owner,
+                            struct sector_pool *pool);
+static bool inode_allocate_index (block_sector_t *index, off_t level, off_t base,
+                                  off_t from, off_t to, enum cache_class class,
+                                  block_sector_t owner, struct sector_pool *pool);
+static void inode_deallocate (const struct inode_disk *inode_disk);
+static void inode_deallocate_index (block_sector_t index, off_t level);
+
+/* Returns entry IDX of the index block at SECTOR, looked up in
+   place in the buffer cache. */
 static block_sector_t
-index_to_sector (const struct inode_disk *inode_disk, off_t index)
+index_block_entry (block_sector_t sector, off_t idx)
+{
+  struct cache_entry *block = cache_get (sector, CACHE_INDEX, CACHE_READ);
+  block_sector_t ret = ((block_sector_t *) cache_buffer (block))[idx];
+  cache_put (block, false);
+  return ret;
+}
+
+/* Returns the number of sector numbers in BLOCKS, at most MAX,
+   that continue the run begun by BLOCKS[0]. */
+static off_t
+run_length (const block_sector_t *blocks, off_t max)
+{
+  off_t cnt = 1;
+
+  while (cnt < max && blocks[cnt] == blocks[0] + cnt)
+    cnt++;
+  return cnt;
+}
+
+/* Stores into *RUN the longest run of blocks of INODE_DISK that
+   starts at block INDEX, spans at most LIMIT blocks and is
+   described by a single extent, index block or the inode's
+   direct blocks.  Sets RUN->count to 0 if block INDEX, or an
+   index block on the way to it, is not mapped. */
+static void
+index_to_run (const struct inode_disk *inode_disk, off_t index, off_t limit,
+              struct block_run *run)
 {
-  block_sector_t ret;
-  if (index < DIRECT_BLOCK_SIZE)
-    return inode_disk->direct_blocks[index];
+  struct cache_entry *block;
+  const block_sector_t *blocks;
+  block_sector_t leaf;
+  off_t idx;
+
+  ASSERT (limit > 0);
+  run->index = index;
+  if (uses_extents (inode_disk))
+  {
+    struct extent e;
+    if (extent_lookup (&inode_disk->extents, index, &e))
+    {
+      run->sector = e.start;
+      run->count = (off_t) e.count < limit ? (off_t) e.count : limit;
+    }
+    else
+      run->count = 0;
+    return;
+  }
+  else if (index < DIRECT_BLOCK_SIZE)
+  {
+    if (limit > DIRECT_BLOCK_SIZE - index)
+      limit = DIRECT_BLOCK_SIZE - index;
+    run->sector = inode_disk->direct_blocks[index];
+    run->count = run->sector != 0
+                 ? run_length (&inode_disk->direct_blocks[index], limit) : 0;
+    return;
+  }
   else if (index < FIRST_INDEX_LEVEL)
   {
-    off_t index_first = (index - DIRECT_BLOCK_SIZE);
-    block_sector_t *sector = calloc (INDEX_SIZE, sizeof *sector);
-    cache_read (inode_disk->first_index, sector);
-    ret = *(sector + index_first);
-    free (sector);
-    return ret;
+    leaf = inode_disk->first_index;
+    idx = index - DIRECT_BLOCK_SIZE;
   }
   else if (index < SECOND_INDEX_LEVEL)
   {
     off_t index_first = (index - FIRST_INDEX_LEVEL) / INDEX_SIZE;
-    off_t index_second = (index - FIRST_INDEX_LEVEL) % INDEX_SIZE;
-    block_sector_t *sector = calloc (INDEX_SIZE, sizeof *sector);
-    cache_read (inode_disk->second_index, sector);
-    cache_read (*(sector + index_first), sector);
-    ret = *(sector + index_second);
-    free (sector);
-    return ret;
+    leaf = inode_disk->second_index;
+    if (leaf != 0)
+      leaf = index_block_entry (leaf, index_first);
+    idx = (index - FIRST_INDEX_LEVEL) % INDEX_SIZE;
   }
   else if (index < THIRD_INDEX_LEVEL)
   {
-    off_t index_first = (index - SECOND_INDEX_LEVEL) / INDEX_SIZE;
-    off_t index_second = (index - SECOND_INDEX_LEVEL - index_first * INDEX_SIZE) / INDEX_SIZE;
-    off_t index_third = (index - SECOND_INDEX_LEVEL - index_first * INDEX_SIZE) % INDEX_SIZE;
-    block_sector_t *sector = calloc (INDEX_SIZE, sizeof *sector);
-    cache_read (inode_disk->third_index, sector);
-    cache_read (*(sector + index_first), sector);
-    cache_read (*(sector + index_second), sector);
-    ret = *(sector + index_third);
-    free (sector);
-    return ret;
+    off_t index_first = (index - SECOND_INDEX_LEVEL) / (INDEX_SIZE * INDEX_SIZE);
+    off_t index_second = (index - SECOND_INDEX_LEVEL) / INDEX_SIZE % INDEX_SIZE;
+    leaf = inode_disk->third_index;
+    if (leaf != 0)
+      leaf = index_block_entry (leaf, index_first);
+    if (leaf != 0)
+      leaf = index_block_entry (leaf, index_second);
+    idx = (index - SECOND_INDEX_LEVEL) % INDEX_SIZE;
   }
-  else 
-    return -1;
+  else
+  {
+    run->count = 0;
+    return;
+  }
+
+  if (leaf == 0)
+  {
+    run->count = 0;
+    return;
+  }
+  if (limit > INDEX_SIZE - idx)
+    limit = INDEX_SIZE - idx;
+  block = cache_get (leaf, CACHE_INDEX, CACHE_READ);
+  blocks = (const block_sector_t *) cache_buffer (block) + idx;
+  run->sector = blocks[0];
+  run->count = run->sector != 0 ? run_length (blocks, limit) : 0;
+  cache_put (block, false);
+}
+
+/* Forgets the block runs INODE has translated, after a change to
+   its block map.  The caller must hold INODE's map_lock. */
+static void
+inode_map_invalidate (struct inode *inode)
+{
+  int i;
+
+  ASSERT (lock_held_by_current_thread (&inode->map_lock));
+  for (i = 0; i < MAP_CACHE_SIZE; i++)
+    inode->map[i].count = 0;
+  inode->map_next = 0;
 }
 
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   POS, either because POS is past the end of INODE or because it
+   lies in a hole that has never been written, or if INODE holds
+   its data inline. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
+  block_sector_t sector = -1;
+  struct cache_entry *block;
+  struct block_run *run;
+  off_t index;
+  int i;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length){
-    off_t index = pos / BLOCK_SECTOR_SIZE;
-    return index_to_sector (&inode->data, index);
-  }
-  else
+  if (pos >= inode->length)
     return -1;
+
+  index = pos / BLOCK_SECTOR_SIZE;
+  lock_acquire (&inode->map_lock);
+  if (inode->magic == INODE_INLINE_MAGIC)
+    goto done;
+  for (i = 0; i < MAP_CACHE_SIZE; i++)
+    {
+      run = &inode->map[i];
+      if (index >= run->index && index < run->index + run->count)
+        {
+          sector = run->sector + (index - run->index);
+          goto done;
+        }
+    }
+
+  /* Walk the index blocks and remember the run found, if the
+     block is not in a hole. */
+  run = &inode->map[inode->map_next];
+  index_to_run (disk_get (inode, CACHE_READ, &block), index,
+                bytes_to_sectors (inode->length) - index, run);
+  disk_put (inode, block, false);
+  if (run->count > 0)
+    {
+      sector = run->sector;
+      inode->map_next = (inode->map_next + 1) % MAP_CACHE_SIZE;
+    }
+
+ done:
+  lock_release (&inode->map_lock);
+  return sector;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+/* Number of times an inode has been closed by its last opener,
+   so that inode_open() can tell whether one was closed while it
+   read the disk.  Protected by open_inodes_lock. */
+static unsigned last_close_cnt;
+
+static unsigned inode_hash (const struct hash_elem *e, void *aux UNUSED);
+static bool inode_less (const struct hash_elem *lhs, const struct hash_elem *rhs, void *aux UNUSED);
+
+/* A pending read-ahead of LENGTH bytes of INODE from OFFSET. */
+struct readahead
+  {
+    struct inode *inode;
+    off_t offset;
+    off_t length;
+  };
+
+/* Queue of pending read-aheads, served by readahead_daemon().
+   Requests that do not fit are dropped; they are only hints. */
+#define READAHEAD_QUEUE_SIZE 16
+static struct readahead readahead_queue[READAHEAD_QUEUE_SIZE];
+static size_t readahead_head;           /* Index of oldest request. */
+static size_t readahead_cnt;            /* Number of queued requests. */
+static struct inode *readahead_inode;   /* Inode being read ahead. */
+static struct lock readahead_lock;
+static struct condition readahead_cond;
+
+static void readahead_daemon (void *aux UNUSED);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("open inode table creation failed");
+  lock_init (&open_inodes_lock);
+  lock_init (&readahead_lock);
+  cond_init (&readahead_cond);
+  readahead_head = readahead_cnt = 0;
+  readahead_inode = NULL;
+  thread_create ("readahead", PRI_DEFAULT, readahead_daemon, NULL);
 }
 
-static bool 
-inode_allocate_index (block_sector_t *index, size_t sectors, off_t level)
+/* Asynchronously brings LENGTH bytes of INODE starting at OFFSET
+   into the buffer cache, together with the index blocks needed
+   to find them. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t length)
 {
-  if (level == 0)
-  {
-    if (*index == 0)
+  lock_acquire (&readahead_lock);
+  if (readahead_cnt > 0)
     {
-      if (!free_map_allocate (1, index))
-        return false;
-      cache_write (*index, zeros);
+      /* Extend the newest request if this one continues it. */
+      struct readahead *last = &readahead_queue[(readahead_head + readahead_cnt - 1)
+                                                % READAHEAD_QUEUE_SIZE];
+      if (last->inode == inode && last->offset + last->length == offset)
+        {
+          last->length += length;
+          lock_release (&readahead_lock);
+          return;
+        }
     }
-    return true;
-  }
-  block_sector_t blocks[INDEX_SIZE];
+  if (readahead_cnt < READAHEAD_QUEUE_SIZE)
+    {
+      struct readahead *ra = &readahead_queue[(readahead_head + readahead_cnt++)
+                                              % READAHEAD_QUEUE_SIZE];
+      ra->inode = inode;
+      ra->offset = offset;
+      ra->length = length;
+      cond_broadcast (&readahead_cond, &readahead_lock);
+    }
+  lock_release (&readahead_lock);
+}
+
+/* Brings LENGTH bytes of INODE starting at OFFSET into the buffer
+   cache before returning, together with the index blocks needed
+   to find them, one sector at a time.  Holes are skipped. */
+void
+inode_prefetch (struct inode *inode, off_t offset, off_t length)
+{
+  off_t ofs;
+
+  for (ofs = offset; ofs < offset + length; ofs += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, ofs);
+      if (sector != (block_sector_t) -1)
+        cache_prefetch (sector, inode_data_class (inode));
+      else if (ofs >= inode_length (inode))
+        break;
+    }
+}
+
+/* Marks the cached data of LENGTH bytes of INODE starting at
+   OFFSET as the first to be evicted.  Only sectors that lie wholly
+   within the range are affected. */
+void
+inode_dontneed (struct inode *inode, off_t offset, off_t length)
+{
+  off_t ofs = ROUND_UP (offset, BLOCK_SECTOR_SIZE);
+  off_t end = offset + length;
+
+  if (end > inode_length (inode))
+    end = ROUND_UP (inode_length (inode), BLOCK_SECTOR_SIZE);
+  for (; ofs + BLOCK_SECTOR_SIZE <= end; ofs += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, ofs);
+      if (sector != (block_sector_t) -1)
+        cache_demote (sector);
+    }
+}
+
+/* Drops pending read-aheads of INODE and waits for one in
+   progress to finish, so that INODE may be freed. */
+static void
+readahead_cancel (struct inode *inode)
+{
+  size_t i, kept = 0;
+
+  lock_acquire (&readahead_lock);
+  for (i = 0; i < readahead_cnt; i++)
+    {
+      struct readahead *ra = &readahead_queue[(readahead_head + i)
+                                              % READAHEAD_QUEUE_SIZE];
+      if (ra->inode != inode)
+        readahead_queue[(readahead_head + kept++) % READAHEAD_QUEUE_SIZE] = *ra;
+    }
+  readahead_cnt = kept;
+  while (readahead_inode == inode)
+    cond_wait (&readahead_cond, &readahead_lock);
+  lock_release (&readahead_lock);
+}
+
+/* Read-ahead thread.  Walks queued requests one sector at a time,
+   so that the index blocks and data sectors they touch are
+   brought into the cache while their reader is busy elsewhere. */
+static void
+readahead_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct readahead ra;
+
+      lock_acquire (&readahead_lock);
+      while (readahead_cnt == 0)
+        cond_wait (&readahead_cond, &readahead_lock);
+      ra = readahead_queue[readahead_head];
+      readahead_head = (readahead_head + 1) % READAHEAD_QUEUE_SIZE;
+      readahead_cnt--;
+      readahead_inode = ra.inode;
+      lock_release (&readahead_lock);
+
+      inode_prefetch (ra.inode, ra.offset, ra.length);
+
+      lock_acquire (&readahead_lock);
+      readahead_inode = NULL;
+      cond_broadcast (&readahead_cond, &readahead_lock);
+      lock_release (&readahead_lock);
+    }
+}
+
+/* Takes up to MAX consecutive sectors from POOL, refilling it
+   first with a run of as many sectors as are still wanted, as
+   close after POOL->goal as the free map allows, if it is empty.
+   Stores the first sector into *SECTORP and returns the number
+   taken, or 0 if the disk is full. */
+static size_t
+pool_take (struct sector_pool *pool, size_t max, block_sector_t *sectorp)
+{
+  size_t cnt = free_map_take (&pool->reserve, pool->goal, pool->want,
+                              pool->extra, max, sectorp);
+
+  if (cnt == 0)
+    return 0;
+  pool->goal = *sectorp + cnt;
+  pool->want = pool->want > cnt ? pool->want - cnt : 0;
+  return cnt;
+}
+
+/* Maps blocks FROM up to TO of the file, of those mapped through
+   *INDEX, allocating a sector for *INDEX itself first if it has
+   none.  *INDEX is an index block LEVEL levels above the data
+   blocks, or the data block itself if LEVEL is 0, and maps the
+   blocks from block BASE on. */
+static bool 
+inode_allocate_index (block_sector_t *index, off_t level, off_t base,
+                      off_t from, off_t to, enum cache_class class,
+                      block_sector_t owner, struct sector_pool *pool)
+{
   if (*index == 0)
   {
-    free_map_allocate (1, index);
-    cache_write (*index, zeros);
+    if (!pool_take (pool, 1, index))
+      return false;
+    if (level > 0)
+      cache_write (*index, CACHE_INDEX, owner, zeros);
+    else if (pool->zero)
+      cache_write (*index, class, owner, zeros);
   }
-  cache_read (*index, &blocks);
-  if (level == 1)
+  if (level == 0)
+    return true;
+
+  /* Number of blocks mapped through each entry. */
+  off_t span = 1;
+  for (off_t l = 1; l < level; l++)
+    span *= INDEX_SIZE;
+
+  /* Fill in the index block in place. */
+  struct cache_entry *block = cache_get (*index, CACHE_INDEX, CACHE_WRITE);
+  block_sector_t *blocks = cache_buffer (block);
+  bool success = true;
+  cache_set_owner (block, owner);
+  for (off_t i = from > base ? (from - base) / span : 0;
+       i < INDEX_SIZE && base + i * span < to && success; i++)
+    success = inode_allocate_index (&blocks[i], level - 1, base + i * span,
+                                    from, to, class, owner, pool);
+  cache_put (block, true);
+  return success;
+}
+
+/* Maps blocks FROM up to TO of INODE_DISK, which uses extents,
+   allocating sectors from POOL for those not yet mapped. */
+static bool
+inode_allocate_extents (struct inode_disk *inode_disk, off_t from, off_t to,
+                        enum cache_class class, block_sector_t owner,
+                        struct sector_pool *pool)
+{
+  struct extent_root *root = &inode_disk->extents;
+  off_t index = from;
+
+  while (index < to)
   {
-    for (size_t i = 0; i < sectors; i++)
+    struct extent e;
+    off_t hole;
+
+    if (extent_lookup (root, index, &e))
     {
-      if (!inode_allocate_index (&blocks[i], 1, level - 1))
-        return false;
+      index += e.count;
+      continue;
     }
-  }
-  else if (level == 2)
-  {
-    size_t num = DIV_ROUND_UP (sectors, INDEX_SIZE);
-    for (size_t i = 0; i < num; i++)
+
+    /* Fill the hole that starts at INDEX, as far as TO. */
+    hole = e.count == 0 || (off_t) e.count > to - index ? to - index : (off_t) e.count;
+    while (hole > 0)
     {
-      size_t subsize = sectors < INDEX_SIZE ? sectors : INDEX_SIZE;
-      if (!inode_allocate_index (&blocks[i], subsize, level - 1))
+      block_sector_t start;
+      size_t cnt = pool_take (pool, hole, &start);
+      if (cnt == 0)
         return false;
-      sectors -= subsize;
-    }
-  }
-  else if (level == 3)
-  {
-    size_t num = DIV_ROUND_UP (sectors, INDEX_SIZE * INDEX_SIZE);
-    for (size_t i = 0; i < num; i++)
-    {
-      size_t subsize = sectors < INDEX_SIZE * INDEX_SIZE ? sectors : INDEX_SIZE * INDEX_SIZE;
-      if (!inode_allocate_index (&blocks[i], subsize, level - 1))
+      if (!extent_insert (root, index, start, cnt, owner))
+      {
+        free_map_release (start, cnt);
         return false;
-      sectors -= subsize;
+      }
+      for (size_t i = 0; pool->zero && i < cnt; i++)
+        cache_write (start + i, class, owner, zeros);
+      index += cnt;
+      hole -= cnt;
     }
   }
-
-  cache_write (*index, &blocks);
   return true;
 }
 
+/* Maps blocks FROM up to TO of INODE_DISK, which uses index
+   blocks, allocating sectors from POOL for those not yet
+   mapped. */
 static bool
-inode_allocate (struct inode_disk *inode_disk, off_t length)
+inode_allocate_indexed (struct inode_disk *inode_disk, off_t from, off_t to,
+                        enum cache_class class, block_sector_t owner,
+                        struct sector_pool *pool)
 {
-  ASSERT (length >= 0);
-
-  size_t sectors = bytes_to_sectors(length);
-  size_t num;
+  if (to > THIRD_INDEX_LEVEL)
+    return false;
 
-  num = sectors < DIRECT_BLOCK_SIZE ? sectors : DIRECT_BLOCK_SIZE;
-  for (size_t i = 0; i < num; i++)
+  for (off_t i = from; i < to && i < DIRECT_BLOCK_SIZE; i++)
   {
     if (inode_disk->direct_blocks[i] == 0)
     {
-      if (!free_map_allocate (1, &inode_disk->direct_blocks[i]))
+      if (!pool_take (pool, 1, &inode_disk->direct_blocks[i]))
         return false;
-      cache_write (inode_disk->direct_blocks[i], zeros);
+      if (pool->zero)
+        cache_write (inode_disk->direct_blocks[i], class, owner, zeros);
     }
   }
-  sectors -= num;
-  if (sectors == 0) return true;
 
-  num = sectors < INDEX_SIZE ? sectors : INDEX_SIZE;
-  if (!inode_allocate_index (&inode_disk->first_index, num, 1))
+  if (to > DIRECT_BLOCK_SIZE && from < FIRST_INDEX_LEVEL
+      && !inode_allocate_index (&inode_disk->first_index, 1, DIRECT_BLOCK_SIZE,
+                                from, to, class, owner, pool))
     return false;
-  sectors -= num;
-  if (sectors == 0) return true;
-
-  num = sectors < INDEX_SIZE * INDEX_SIZE ? sectors : INDEX_SIZE * INDEX_SIZE;
-  if (!inode_allocate_index (&inode_disk->second_index, num, 2))
+  if (to > FIRST_INDEX_LEVEL && from < SECOND_INDEX_LEVEL
+      && !inode_allocate_index (&inode_disk->second_index, 2, FIRST_INDEX_LEVEL,
+                                from, to, class, owner, pool))
     return false;
-  sectors -= num;
-  if (sectors == 0) return true;
-
-  num = sectors < INDEX_SIZE * INDEX_SIZE * INDEX_SIZE ? sectors : INDEX_SIZE;
-  if (!inode_allocate_index (&inode_disk->third_index, num, 3))
+  if (to > SECOND_INDEX_LEVEL
+      && !inode_allocate_index (&inode_disk->third_index, 3, SECOND_INDEX_LEVEL,
+                                from, to, class, owner, pool))
     return false;
-  sectors -= num;
-  if (sectors == 0) return true;
+  return true;
+}
+
+/* Maps blocks FROM up to TO of INODE_DISK, skipping those already
+   mapped.  The new blocks are of class CLASS, owned by the inode
+   at OWNER, zeroed if POOL->zero, and taken first from POOL, which
+   is refilled with as few runs of consecutive sectors as the free
+   map allows.  POOL->extra gives the number of sectors to set
+   aside beyond those needed; the caller must return those left in
+   POOL to the free map.  All of the changes to the free map are
+   written at once.  If the disk fills up, the blocks mapped are
+   still those from FROM up to the first that could not be. */
+static bool
+inode_allocate (struct inode_disk *inode_disk, off_t from, off_t to,
+                enum cache_class class, block_sector_t owner,
+                struct sector_pool *pool)
+{
+  size_t need = to > from ? to - from : 0;
+  bool success;
+
+  ASSERT (from >= 0);
+
+  if (!uses_extents (inode_disk))
+    need += DIV_ROUND_UP (need, INDEX_SIZE) + 2;
+  pool->want += need;
+
+  free_map_batch_begin ();
+  if (uses_extents (inode_disk))
+    success = inode_allocate_extents (inode_disk, from, to, class, owner, pool);
+  else
+    success = inode_allocate_indexed (inode_disk, from, to, class, owner, pool);
+  free_map_batch_end ();
+  return success;
+}
+
+/* Zeroes the blocks of INODE, whose on-disk inode is INODE_DISK,
+   from block FROM up to block TO that are mapped. */
+static void
+inode_zero_blocks (struct inode *inode, const struct inode_disk *inode_disk,
+                   off_t from, off_t to)
+{
+  while (from < to)
+    {
+      struct block_run run;
+      off_t i;
 
-  return false;
+      index_to_run (inode_disk, from, to - from, &run);
+      if (run.count == 0)
+        break;
+      for (i = 0; i < run.count; i++)
+        cache_write (run.sector + i, inode_data_class (inode), inode->sector,
+                     zeros);
+      from += run.count;
+    }
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -234,6 +729,7 @@ bool
 inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
+  struct sector_pool pool;
   bool success = false;
 
   ASSERT (length >= 0);
@@ -245,14 +741,29 @@ inode_create (block_sector_t sector, off_t length, bool is_dir)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
       disk_inode->is_dir = is_dir;
-      if (inode_allocate (disk_inode, disk_inode->length)) 
+      free_map_reserve_init (&pool.reserve);
+      pool.want = pool.extra = 0;
+      pool.goal = sector + 1;
+      pool.zero = true;
+
+      /* Small files keep their data in the inode itself.  The free
+         map's file always has blocks, so that writing it never
+         needs an allocation. */
+      if (!is_dir && sector != FREE_MAP_SECTOR && length <= INLINE_SIZE)
+        disk_inode->magic = INODE_INLINE_MAGIC;
+      else
+        disk_inode->magic = default_magic ();
+
+      if (is_inline (disk_inode)
+          || inode_allocate (disk_inode, 0, bytes_to_sectors (length),
+                             data_class (sector, is_dir), sector, &pool)) 
         {
-          cache_write (sector, disk_inode);
+          disk_inode->length = length;
+          cache_write (sector, CACHE_INODE, sector, disk_inode);
           success = true; 
         } 
+      free_map_unreserve (&pool.reserve, 0);
       free (disk_inode);
     }
   return success;
@@ -264,42 +775,97 @@ inode_create (block_sector_t sector, off_t length, bool is_dir)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
+  unsigned close_cnt;
+
+ retry:
+  lock_acquire (&open_inodes_lock);
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode; 
     }
+  close_cnt = last_close_cnt;
+  lock_release (&open_inodes_lock);
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
     return NULL;
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize, reading the disk inode without holding
+     open_inodes_lock, so that opening other inodes need not wait
+     for the disk. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  cache_read (inode->sector, &inode->data);
+  rwlock_init (&inode->rwlock);
+  struct cache_entry *block;
+  const struct inode_disk *disk = disk_get (inode, CACHE_READ, &block);
+  inode->length = disk->length;
+  inode->is_dir = disk->is_dir;
+  inode->magic = disk->magic;
+  disk_put (inode, block, false);
+  lock_init (&inode->map_lock);
+  lock_acquire (&inode->map_lock);
+  inode_map_invalidate (inode);
+  lock_release (&inode->map_lock);
+  free_map_reserve_init (&inode->prealloc.reserve);
+
+  lock_acquire (&open_inodes_lock);
+  if (last_close_cnt != close_cnt)
+    {
+      /* This inode may have been opened, changed, and closed by
+         another thread since it was read. */
+      lock_release (&open_inodes_lock);
+      free (inode);
+      goto retry;
+    }
+  e = hash_insert (&open_inodes, &inode->elem);
+  if (e != NULL)
+    {
+      /* Another thread opened it meanwhile.  Use its copy. */
+      free (inode);
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+    }
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
+/* Makes new inodes map their blocks with LAYOUT. */
+void
+inode_set_default_layout (enum inode_layout layout)
+{
+  default_layout = layout;
+}
+
+/* Returns the layout of INODE's block map. */
+enum inode_layout
+inode_get_layout (const struct inode *inode)
+{
+  return inode->magic == INODE_EXTENT_MAGIC ? INODE_EXTENTS : INODE_INDEXED;
+}
+
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -310,96 +876,42 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
+/* Releases the sector INDEX, an index block LEVEL levels above
+   the data blocks or a data block if LEVEL is 0, together with
+   every sector mapped through it.  Does nothing for a hole. */
 static void
-inode_deallocate_index (block_sector_t index, size_t sectors, off_t level)
+inode_deallocate_index (block_sector_t index, off_t level)
 {
-  if (level == 0)
-  {
-    free_map_release (index, 1);
+  if (index == 0)
     return;
-  }
-  block_sector_t blocks[INDEX_SIZE];
-  cache_read (index, &blocks);
-  if (level == 1)
-  {
-    for (size_t i = 0; i < sectors; i++)
-    {
-      inode_deallocate_index (blocks[i], 1, level - 1);
-    }
-  }
-  else if (level == 2)
-  {
-    size_t num = DIV_ROUND_UP (sectors, INDEX_SIZE);
-    for (size_t i = 0; i < num; i++)
-    {
-      size_t subsize = sectors > INDEX_SIZE ? INDEX_SIZE : sectors;
-      inode_deallocate_index (blocks[i], subsize, level - 1);
-      sectors -= subsize;
-    }
-  }
-  else if (level == 3)
+  if (level > 0)
   {
-    size_t num = DIV_ROUND_UP (sectors, INDEX_SIZE * INDEX_SIZE);
-    for (size_t i = 0; i < num; i++)
-    {
-      size_t subsize = sectors > INDEX_SIZE * INDEX_SIZE ? INDEX_SIZE * INDEX_SIZE : sectors;
-      inode_deallocate_index (blocks[i], subsize, level - 1);
-      sectors -= subsize;
-    }
+    struct cache_entry *block = cache_get (index, CACHE_INDEX, CACHE_READ);
+    const block_sector_t *blocks = cache_buffer (block);
+    for (size_t i = 0; i < INDEX_SIZE; i++)
+      inode_deallocate_index (blocks[i], level - 1);
+    cache_put (block, false);
   }
   free_map_release (index, 1);
-  return;
 }
 
+/* Releases every sector that INODE_DISK maps. */
 static void
-inode_deallocate (struct inode *inode, off_t length)
+inode_deallocate (const struct inode_disk *inode_disk)
 {
-  ASSERT (length >= 0 && length < THIRD_INDEX_LEVEL);
-
-  size_t sectors = bytes_to_sectors (length);
-  if (sectors < DIRECT_BLOCK_SIZE)
-  {
-    for (size_t i = 0; i < sectors; i++)
-    {
-      free_map_release (inode->data.direct_blocks[i], 1);
-    }
-    return;
-  }
-  else
-  {
-    for (size_t i = 0; i < DIRECT_BLOCK_SIZE; i++)
-    {
-      free_map_release (inode->data.direct_blocks[i], 1);
-    }
-  }
-
-  if (sectors < FIRST_INDEX_LEVEL)
-  {
-    inode_deallocate_index (inode->data.first_index, sectors - DIRECT_BLOCK_SIZE, 1);
+  if (is_inline (inode_disk))
     return;
-  }
-  else
+  if (uses_extents (inode_disk))
   {
-    inode_deallocate_index (inode->data.first_index, FIRST_INDEX_LEVEL - DIRECT_BLOCK_SIZE, 1);
-  }
-
-  if (sectors < SECOND_INDEX_LEVEL)
-  {
-    inode_deallocate_index (inode->data.second_index, sectors - FIRST_INDEX_LEVEL, 2);
+    extent_free (&inode_disk->extents);
     return;
   }
-  else
-  {
-    inode_deallocate_index (inode->data.second_index, SECOND_INDEX_LEVEL - FIRST_INDEX_LEVEL, 2);
-  }
 
-  if (sectors < THIRD_INDEX_LEVEL)
-  {
-    inode_deallocate_index (inode->data.third_index, sectors - SECOND_INDEX_LEVEL, 3);
-    return;
-  }
-  else
-    return;
+  for (size_t i = 0; i < DIRECT_BLOCK_SIZE; i++)
+    inode_deallocate_index (inode_disk->direct_blocks[i], 0);
+  inode_deallocate_index (inode_disk->first_index, 1);
+  inode_deallocate_index (inode_disk->second_index, 2);
+  inode_deallocate_index (inode_disk->third_index, 3);
 }
 
 /* Closes INODE and writes it to disk.
@@ -413,20 +925,36 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
+  lock_acquire (&open_inodes_lock);
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      /* Remove from inode table and release lock. */
+      hash_delete (&open_inodes, &inode->elem);
+      last_close_cnt++;
+      lock_release (&open_inodes_lock);
+      readahead_cancel (inode);
  
-      /* Deallocate blocks if removed. */
+      /* Return the sectors set aside for growth, and deallocate
+         blocks if removed. */
+      struct cache_entry *block = NULL;
+      const struct inode_disk *disk = NULL;
+      if (inode->removed)
+        disk = disk_get (inode, CACHE_READ, &block);
+      free_map_batch_begin ();
+      free_map_unreserve (&inode->prealloc.reserve, 0);
       if (inode->removed) 
         {
           free_map_release (inode->sector, 1);
-          inode_deallocate (inode, inode->data.length); 
+          inode_deallocate (disk);
         }
+      free_map_batch_end ();
+      if (block != NULL)
+        disk_put (inode, block, false);
 
       free (inode); 
     }
+  else
+    lock_release (&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -435,19 +963,38 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&open_inodes_lock);
   inode->removed = true;
+  lock_release (&open_inodes_lock);
 }
 
-/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
-   Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
-off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+/* Reads SIZE bytes from INODE into BUFFER, which must be in
+   kernel memory, starting at position OFFSET.  Returns the number
+   of bytes actually read. */
+static off_t
+inode_read_direct (struct inode *inode, void *buffer_, off_t size,
+                   off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
+  ASSERT (!is_user_vaddr (buffer));
+
+  rwlock_acquire_read (&inode->rwlock);
+  if (inode->magic == INODE_INLINE_MAGIC)
+    {
+      if (offset < inode->length)
+        {
+          struct cache_entry *block;
+          const struct inode_disk *disk = disk_get (inode, CACHE_READ, &block);
+          bytes_read = inode->length - offset;
+          if (bytes_read > size)
+            bytes_read = size;
+          memcpy (buffer, disk->inline_data + offset, bytes_read);
+          disk_put (inode, block, false);
+        }
+      size = 0;
+    }
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -464,23 +1011,20 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (sector_idx == (block_sector_t) -1)
         {
-          /* Read full sector directly into caller's buffer. */
-          cache_read (sector_idx, buffer + bytes_read);
+          /* A hole reads as zeros. */
+          memset (buffer + bytes_read, 0, chunk_size);
         }
-      else 
+      else
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          cache_read (sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          /* Copy straight out of the cached sector. */
+          struct cache_entry *block = cache_get (sector_idx,
+                                                 inode_data_class (inode),
+                                                 CACHE_READ);
+          memcpy (buffer + bytes_read,
+                  (uint8_t *) cache_buffer (block) + sector_ofs, chunk_size);
+          cache_put (block, false);
         }
       
       /* Advance. */
@@ -488,36 +1032,136 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->rwlock);
 
   return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
+   Returns the number of bytes actually read, which may be less
+   than SIZE if an error occurs or end of file is reached.
+
+   A user BUFFER is filled a page at a time through a kernel page,
+   so that no cache entry is pinned while copying to it: a page
+   fault there may write back a mapped page of this same file. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset) 
+inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
-  const uint8_t *buffer = buffer_;
-  off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  uint8_t *buffer = buffer_;
+  uint8_t *bounce;
+  off_t bytes_read = 0;
+
+  if (!is_user_vaddr (buffer))
+    return inode_read_direct (inode, buffer, size, offset);
 
-  if (inode->deny_write_cnt)
+  bounce = palloc_get_page (0);
+  if (bounce == NULL)
     return 0;
+  while (size > 0)
+    {
+      off_t chunk_size = size < PGSIZE ? size : PGSIZE;
+      off_t chunk_read = inode_read_direct (inode, bounce, chunk_size,
+                                            offset);
+      memcpy (buffer + bytes_read, bounce, chunk_read);
+      bytes_read += chunk_read;
+      if (chunk_read < chunk_size)
+        break;
+      size -= chunk_read;
+      offset += chunk_read;
+    }
+  palloc_free_page (bounce);
+  return bytes_read;
+}
 
-  /* Extend the file when EOF extends. */
-  if (byte_to_sector (inode, offset + size - 1) == -1u)
+/* Maps the blocks of INODE that hold bytes OFFSET up to END and
+   are not mapped yet, and extends INODE to END bytes if it is
+   shorter, for a write of those bytes.  Of the new blocks, only
+   those that the write fills in part are zeroed.  If the disk
+   fills up, maps the blocks from OFFSET on up to the first that
+   cannot be, extends INODE to that point at most, or not at all
+   if that is not past OFFSET, and returns false. */
+static bool
+inode_fill (struct inode *inode, off_t offset, off_t end)
+{
+  off_t first = offset / BLOCK_SECTOR_SIZE;
+  off_t last = DIV_ROUND_UP (end, BLOCK_SECTOR_SIZE);
+  struct cache_entry *block;
+  struct inode_disk *disk;
+  struct block_run run;
+  bool zero_first, zero_last, success;
+
+  ASSERT (rwlock_held_for_write (&inode->rwlock));
+
+  /* Keep the read-ahead thread from translating blocks while
+     the block map changes. */
+  lock_acquire (&inode->map_lock);
+  disk = disk_get (inode, CACHE_WRITE, &block);
+  index_to_run (disk, first, 1, &run);
+  zero_first = run.count == 0 && offset % BLOCK_SECTOR_SIZE != 0;
+  index_to_run (disk, last - 1, 1, &run);
+  zero_last = run.count == 0 && end % BLOCK_SECTOR_SIZE != 0;
+
+  inode->prealloc.want = 0;
+  inode->prealloc.extra = PREALLOC_SECTORS;
+  inode->prealloc.zero = false;
+
+  /* Should more sectors have to be set aside, place them right
+     after the block before the new ones, or after the inode. */
+  inode->prealloc.goal = inode->sector + 1;
+  if (first > 0)
+    {
+      index_to_run (disk, first - 1, 1, &run);
+      if (run.count > 0)
+        inode->prealloc.goal = run.sector + 1;
+    }
+  success = inode_allocate (disk, first, last,
+                            inode_data_class (inode), inode->sector,
+                            &inode->prealloc);
+
+  /* Keep no more set aside than the next appends may use, and
+     nothing once the disk is full. */
+  free_map_unreserve (&inode->prealloc.reserve,
+                      success ? PREALLOC_SECTORS : 0);
+  if (!success)
   {
-    bool success = inode_allocate (&inode->data, offset + size);
-    if (!success) return 0;
-
-    inode->data.length = offset + size;
-    cache_write (inode->sector, &inode->data);
+    /* Cut the write short at the first block left unmapped. */
+    off_t index = first;
+    while (index < last)
+    {
+      index_to_run (disk, index, last - index, &run);
+      if (run.count == 0)
+        break;
+      index += run.count;
+    }
+    if (end > index * BLOCK_SECTOR_SIZE)
+      end = index * BLOCK_SECTOR_SIZE;
+    zero_first = zero_first && index > first;
+    zero_last = false;
   }
+  if (zero_first)
+    inode_zero_blocks (inode, disk, first, first + 1);
+  if (zero_last)
+    inode_zero_blocks (inode, disk, last - 1, last);
+  if (end > disk->length && end > offset)
+    disk->length = end;
+  inode->length = disk->length;
+
+  /* Record the blocks allocated, even if not all of them were. */
+  disk_put (inode, block, true);
+  inode_map_invalidate (inode);
+  lock_release (&inode->map_lock);
+  return success;
+}
+
+/* Writes SIZE bytes from BUFFER into the blocks of INODE,
+   starting at OFFSET, as described for inode_write_at().  The
+   caller must hold INODE's rwlock for writing. */
+static off_t
+inode_write_blocks (struct inode *inode, const uint8_t *buffer, off_t size,
+                    off_t offset)
+{
+  off_t bytes_written = 0;
+  bool filled = false;
 
   while (size > 0) 
     {
@@ -525,6 +1169,19 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
+      /* Past end of file or in a hole, map the blocks for the rest
+         of the write at once. */
+      if (sector_idx == (block_sector_t) -1)
+        {
+          if (filled)
+            break;
+          filled = true;
+          inode_fill (inode, offset, offset + size);
+          sector_idx = byte_to_sector (inode, offset);
+          if (sector_idx == (block_sector_t) -1)
+            break;
+        }
+
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
@@ -535,49 +1192,166 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          cache_write (sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            cache_read (sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          cache_write (sector_idx, bounce);
-        }
+      /* Write straight into the cached sector. */
+      cache_write_at (sector_idx, inode_data_class (inode), inode->sector,
+                      buffer + bytes_written, sector_ofs, chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
   return bytes_written;
 }
 
+/* Moves the inline data of INODE out into blocks, in the default
+   layout, so that it can grow past INLINE_SIZE bytes.  Returns
+   false, leaving INODE unchanged, if memory or disk space runs
+   out.  The caller must hold INODE's rwlock for writing. */
+static bool
+inode_uninline (struct inode *inode)
+{
+  off_t length = inode->length;
+  uint8_t *copy = malloc (INLINE_SIZE);
+  struct cache_entry *block;
+  struct inode_disk *disk;
+  bool success;
+
+  if (copy == NULL)
+    return false;
+
+  /* Keep the read-ahead thread from looking at the block map
+     while it changes. */
+  lock_acquire (&inode->map_lock);
+  disk = disk_get (inode, CACHE_WRITE, &block);
+  memcpy (copy, disk->inline_data, length);
+  memset (disk->inline_data, 0, INLINE_SIZE);
+  disk->magic = inode->magic = default_magic ();
+  disk->length = inode->length = 0;
+  disk_put (inode, block, true);
+  inode_map_invalidate (inode);
+  lock_release (&inode->map_lock);
+
+  success = inode_write_blocks (inode, copy, length, 0) == length;
+  if (!success)
+    {
+      /* Put the data back inline. */
+      lock_acquire (&inode->map_lock);
+      disk = disk_get (inode, CACHE_WRITE, &block);
+      free_map_batch_begin ();
+      inode_deallocate (disk);
+      free_map_batch_end ();
+      memset (disk->inline_data, 0, INLINE_SIZE);
+      memcpy (disk->inline_data, copy, length);
+      disk->magic = inode->magic = INODE_INLINE_MAGIC;
+      disk->length = inode->length = length;
+      disk_put (inode, block, true);
+      inode_map_invalidate (inode);
+      lock_release (&inode->map_lock);
+    }
+  free (copy);
+  return success;
+}
+
+/* Writes SIZE bytes from BUFFER, which must be in kernel memory,
+   into INODE, starting at OFFSET.  Returns the number of bytes
+   actually written. */
+static off_t
+inode_write_direct (struct inode *inode, const void *buffer_, off_t size,
+                    off_t offset)
+{
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+
+  ASSERT (!is_user_vaddr (buffer));
+
+  rwlock_acquire_write (&inode->rwlock);
+  if (inode->deny_write_cnt == 0 && size > 0)
+    {
+      bool inline_data = inode->magic == INODE_INLINE_MAGIC;
+      if (inline_data && offset + size <= INLINE_SIZE)
+        {
+          struct cache_entry *block;
+          struct inode_disk *disk = disk_get (inode, CACHE_WRITE, &block);
+          memcpy (disk->inline_data + offset, buffer, size);
+          if (disk->length < offset + size)
+            disk->length = offset + size;
+          inode->length = disk->length;
+          disk_put (inode, block, true);
+          bytes_written = size;
+        }
+      else if (!inline_data || inode_uninline (inode))
+        bytes_written = inode_write_blocks (inode, buffer, size, offset);
+    }
+  rwlock_release_write (&inode->rwlock);
+
+  return bytes_written;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   Returns the number of bytes actually written, which may be
+   less than SIZE if the disk fills up.  Writing past end of file
+   extends INODE; the bytes skipped over form a hole, which takes
+   no space on disk and reads as zeros until it is written.  An
+   inode with inline data moves it into blocks once it no longer
+   fits.
+
+   A user BUFFER is copied a page at a time into a kernel page
+   first, so that no cache entry is pinned while copying from it:
+   a page fault there may read in a mapped page of this same
+   file. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+                off_t offset) 
+{
+  const uint8_t *buffer = buffer_;
+  uint8_t *bounce;
+  off_t bytes_written = 0;
+
+  if (!is_user_vaddr (buffer))
+    return inode_write_direct (inode, buffer, size, offset);
+
+  bounce = palloc_get_page (0);
+  if (bounce == NULL)
+    return 0;
+  while (size > 0)
+    {
+      off_t chunk_size = size < PGSIZE ? size : PGSIZE;
+      off_t chunk_written;
+
+      memcpy (bounce, buffer + bytes_written, chunk_size);
+      chunk_written = inode_write_direct (inode, bounce, chunk_size, offset);
+      bytes_written += chunk_written;
+      if (chunk_written < chunk_size)
+        break;
+      size -= chunk_written;
+      offset += chunk_written;
+    }
+  palloc_free_page (bounce);
+  return bytes_written;
+}
+
+/* Writes INODE's dirty data, index blocks and on-disk inode back
+   to disk, together with the free map that records their
+   allocation. */
+void
+inode_flush (struct inode *inode)
+{
+  cache_flush_owner (inode->sector);
+  if (inode->sector != FREE_MAP_SECTOR)
+    cache_flush_owner (FREE_MAP_SECTOR);
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -586,22 +1360,24 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
 {
-  return inode->data.length;
+  return inode->length;
 }
 
 bool
 inode_is_dir (const struct inode *inode)
 {
-  return inode->data.is_dir;
+  return inode->is_dir;
 }
 
 bool
@@ -614,4 +1390,19 @@ int
 inode_get_open_cnt (const struct inode *inode)
 {
   return inode->open_cnt;
-}
\ No newline at end of file
+}
+
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *lhs, const struct hash_elem *rhs, void *aux UNUSED)
+{
+  const struct inode *a = hash_entry (lhs, struct inode, elem);
+  const struct inode *b = hash_entry (rhs, struct inode, elem);
+  return a->sector < b->sector;
+}
@@ -7,15 +7,28 @@
 
 struct bitmap;
 
+/* Ways an on-disk inode can map its blocks to sectors. */
+enum inode_layout
+  {
+    INODE_INDEXED,              /* Direct and indirect index blocks. */
+    INODE_EXTENTS               /* Tree of extents. */
+  };
+
 void inode_init (void);
+void inode_set_default_layout (enum inode_layout);
 bool inode_create (block_sector_t, off_t, bool);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
+enum inode_layout inode_get_layout (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+void inode_readahead (struct inode *, off_t offset, off_t length);
+void inode_prefetch (struct inode *, off_t offset, off_t length);
+void inode_dontneed (struct inode *, off_t offset, off_t length);
+void inode_flush (struct inode *);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
@@ -0,0 +1,16 @@
+#ifndef __LIB_ADVISE_H
+#define __LIB_ADVISE_H
+
+/* How a program expects to access a file, for the advise system
+   call.  The first three describe all later reads through an open
+   file; the last two apply to a byte range once. */
+enum advise_hint
+  {
+    ADVISE_NORMAL,              /* No particular pattern. */
+    ADVISE_SEQUENTIAL,          /* From start to end, once. */
+    ADVISE_RANDOM,              /* In no predictable order. */
+    ADVISE_WILLNEED,            /* Range will be read soon. */
+    ADVISE_DONTNEED             /* Range will not be read soon. */
+  };
+
+#endif /* lib/advise.h */
@@ -0,0 +1,27 @@
+#ifndef __LIB_CACHE_STAT_H
+#define __LIB_CACHE_STAT_H
+
+/* Kinds of block kept in the file system buffer cache. */
+enum cache_class
+  {
+    CACHE_INODE,                /* On-disk inode. */
+    CACHE_INDEX,                /* Indirect block of sector numbers. */
+    CACHE_DIR,                  /* Directory contents. */
+    CACHE_DATA,                 /* Regular file contents. */
+    CACHE_FREE_MAP,             /* Free map contents. */
+    CACHE_CLASS_CNT             /* Number of classes. */
+  };
+
+/* Buffer cache activity for one class of block, as reported by
+   the cachestat system call. */
+struct cache_stat
+  {
+    unsigned long long hits;            /* Lookups found in the cache. */
+    unsigned long long misses;          /* Lookups not found. */
+    unsigned long long evictions;       /* Blocks replaced by others. */
+    unsigned long long write_backs;     /* Dirty blocks written to disk. */
+    unsigned long long read_before_writes; /* Misses read from disk only
+                                           to be partly overwritten. */
+  };
+
+#endif /* lib/cache-stat.h */
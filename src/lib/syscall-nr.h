@@ -28,7 +28,11 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+    SYS_CACHESTAT,              /* Reads buffer cache statistics. */
+    SYS_ADVISE,                 /* Declares a file access pattern. */
+    SYS_FSYNC,                  /* Writes a file's data to disk. */
+    SYS_SYNC                    /* Writes all cached data to disk. */
   };
 
 #endif /* lib/syscall-nr.h */
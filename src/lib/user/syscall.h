@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <advise.h>
+#include <cache-stat.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -44,5 +46,9 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
+bool cachestat (struct cache_stat stats[CACHE_CLASS_CNT]);
+bool advise (int fd, unsigned offset, unsigned length, enum advise_hint);
+bool fsync (int fd);
+void sync (void);
 
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,152 @@
+/* Gives each advise() hint for a file and checks, with
+   cachestat(), that the hint changes what the buffer cache does:
+   a file advised ADVISE_RANDOM is not read ahead, ADVISE_WILLNEED
+   brings a range in before it is read, and ADVISE_DONTNEED makes
+   a range the first to be evicted.  Also checks that the file
+   still reads back correctly and that a bad hint is refused.
+
+   Runs with a 64-sector cache, which reading "filler" from end
+   to end clears of every block of "data". */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define DATA_BLOCKS 16
+#define FILLER_BLOCKS 128
+
+static char buf[DATA_BLOCKS * BLOCK_SIZE];
+static char buf2[DATA_BLOCKS * BLOCK_SIZE];
+static char block[BLOCK_SIZE];
+
+/* Returns the data block hits and misses so far in *HITS and
+   *MISSES. */
+static void
+data_stats (unsigned long long *hits, unsigned long long *misses)
+{
+  struct cache_stat stats[CACHE_CLASS_CNT];
+
+  if (!cachestat (stats))
+    fail ("cachestat failed");
+  *hits = stats[CACHE_DATA].hits;
+  *misses = stats[CACHE_DATA].misses;
+}
+
+/* Reads CNT blocks of the file open as FD, one at a time,
+   starting at block FIRST.  Returns the data block hits and
+   misses that took in *HITS and *MISSES. */
+static void
+read_blocks (int fd, int first, int cnt,
+             unsigned long long *hits, unsigned long long *misses)
+{
+  unsigned long long hits0, misses0;
+  int i;
+
+  data_stats (&hits0, &misses0);
+  for (i = first; i < first + cnt; i++)
+    {
+      seek (fd, i * BLOCK_SIZE);
+      if (read (fd, block, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("read block %d failed", i);
+    }
+  data_stats (hits, misses);
+  *hits -= hits0;
+  *misses -= misses0;
+}
+
+/* Reads all of "filler", open as FD, so that no block of "data"
+   is left in the cache. */
+static void
+evict_data (int fd)
+{
+  unsigned long long hits, misses;
+
+  read_blocks (fd, 0, FILLER_BLOCKS, &hits, &misses);
+}
+
+static void
+read_back (int fd, const char *hint_name)
+{
+  seek (fd, 0);
+  memset (buf2, 0, sizeof buf2);
+  if (read (fd, buf2, sizeof buf2) != sizeof buf2)
+    fail ("read \"data\" after %s failed", hint_name);
+  if (memcmp (buf, buf2, sizeof buf))
+    fail ("\"data\" read back wrong after %s", hint_name);
+}
+
+void
+test_main (void)
+{
+  unsigned long long hits, misses, hits0, misses0;
+  int fd, filler_fd, i;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"data\"");
+
+  memset (block, 'f', sizeof block);
+  CHECK (create ("filler", 0), "create \"filler\"");
+  CHECK ((filler_fd = open ("filler")) > 1, "open \"filler\"");
+  for (i = 0; i < FILLER_BLOCKS; i++)
+    if (write (filler_fd, block, BLOCK_SIZE) != BLOCK_SIZE)
+      fail ("write \"filler\" failed");
+  CHECK (advise (filler_fd, 0, 0, ADVISE_RANDOM), "advise random on \"filler\"");
+
+  CHECK (advise (fd, 0, 0, ADVISE_SEQUENTIAL), "advise sequential");
+  read_back (fd, "ADVISE_SEQUENTIAL");
+
+  /* Nothing may be read ahead of a file advised ADVISE_RANDOM, so
+     every block misses when it is read. */
+  CHECK (advise (fd, 0, 0, ADVISE_RANDOM), "advise random");
+  evict_data (filler_fd);
+  read_blocks (fd, 0, DATA_BLOCKS, &hits, &misses);
+  if (hits != 0 || misses != DATA_BLOCKS)
+    fail ("reading %d blocks after ADVISE_RANDOM hit %llu and missed %llu",
+          DATA_BLOCKS, hits, misses);
+  read_back (fd, "ADVISE_RANDOM");
+
+  /* ADVISE_WILLNEED reads the range in before it returns, so
+     then every block should hit. */
+  evict_data (filler_fd);
+  data_stats (&hits0, &misses0);
+  CHECK (advise (fd, 0, sizeof buf, ADVISE_WILLNEED), "advise willneed");
+  data_stats (&hits, &misses);
+  if (misses - misses0 < DATA_BLOCKS)
+    fail ("ADVISE_WILLNEED brought in only %llu blocks", misses - misses0);
+  read_blocks (fd, 0, DATA_BLOCKS, &hits, &misses);
+  if (hits != DATA_BLOCKS || misses != 0)
+    fail ("reading %d blocks after ADVISE_WILLNEED hit %llu and missed %llu",
+          DATA_BLOCKS, hits, misses);
+  read_back (fd, "ADVISE_WILLNEED");
+
+  /* With all of "data" cached, advise ADVISE_DONTNEED for its
+     first half.  Reading as many blocks of "filler", which are no
+     longer cached, should evict just that half. */
+  evict_data (filler_fd);
+  read_blocks (fd, 0, DATA_BLOCKS, &hits, &misses);
+  CHECK (advise (fd, 0, sizeof buf / 2, ADVISE_DONTNEED), "advise dontneed");
+  read_blocks (filler_fd, 0, DATA_BLOCKS / 2, &hits, &misses);
+  read_blocks (fd, DATA_BLOCKS / 2, DATA_BLOCKS / 2, &hits, &misses);
+  if (misses != 0)
+    fail ("second half of \"data\" missed %llu times after ADVISE_DONTNEED "
+          "of the first", misses);
+  read_blocks (fd, 0, DATA_BLOCKS / 2, &hits, &misses);
+  if (misses != DATA_BLOCKS / 2)
+    fail ("first half of \"data\" missed only %llu times after "
+          "ADVISE_DONTNEED", misses);
+  read_back (fd, "ADVISE_DONTNEED");
+
+  CHECK (advise (fd, 0, 0, ADVISE_NORMAL), "advise normal");
+  read_back (fd, "ADVISE_NORMAL");
+  CHECK (!advise (fd, 0, 0, 1234), "advise with bad hint must fail");
+
+  msg ("close \"filler\"");
+  close (filler_fd);
+  msg ("close \"data\"");
+  close (fd);
+}
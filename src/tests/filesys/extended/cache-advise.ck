@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-advise) begin
+(cache-advise) create "data"
+(cache-advise) open "data"
+(cache-advise) write "data"
+(cache-advise) create "filler"
+(cache-advise) open "filler"
+(cache-advise) advise random on "filler"
+(cache-advise) advise sequential
+(cache-advise) advise random
+(cache-advise) advise willneed
+(cache-advise) advise dontneed
+(cache-advise) advise normal
+(cache-advise) advise with bad hint must fail
+(cache-advise) close "filler"
+(cache-advise) close "data"
+(cache-advise) end
+EOF
+pass;
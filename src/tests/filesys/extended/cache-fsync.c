@@ -0,0 +1,76 @@
+/* Writes two files, then checks that fsync() writes back the
+   dirty data of the one file it is given and leaves the other's
+   dirty in the buffer cache, and that sync() writes back
+   everything.  Runs with write-behind turned off. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[4096];
+
+#define BUF_BLOCKS (sizeof buf / 512)
+
+/* Returns the number of data blocks written back so far. */
+static unsigned long long
+data_write_backs (void)
+{
+  struct cache_stat stats[CACHE_CLASS_CNT];
+
+  CHECK (cachestat (stats), "cachestat");
+  return stats[CACHE_DATA].write_backs;
+}
+
+/* Calls fsync() on FD, named NAME, and checks that it writes back
+   exactly CNT data blocks. */
+static void
+check_fsync (int fd, const char *name, unsigned long long cnt)
+{
+  unsigned long long before, after;
+
+  before = data_write_backs ();
+  CHECK (fsync (fd), "fsync \"%s\"", name);
+  after = data_write_backs ();
+  if (after - before != cnt)
+    fail ("fsync \"%s\" wrote back %llu blocks, not %llu",
+          name, after - before, cnt);
+}
+
+void
+test_main (void) 
+{
+  unsigned long long before, after;
+  int fd, other_fd;
+
+  memset (buf, 'f', sizeof buf);
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  CHECK (create ("other", 0), "create \"other\"");
+  CHECK ((other_fd = open ("other")) > 1, "open \"other\"");
+  CHECK (write (other_fd, buf, sizeof buf) == sizeof buf, "write \"other\"");
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"data\"");
+
+  /* Only the blocks of "data" are written back, and only once. */
+  check_fsync (fd, "data", BUF_BLOCKS);
+  check_fsync (fd, "data", 0);
+
+  /* So the blocks of "other" were still dirty. */
+  check_fsync (other_fd, "other", BUF_BLOCKS);
+
+  before = data_write_backs ();
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"data\" again");
+  CHECK (write (other_fd, buf, sizeof buf) == sizeof buf,
+         "write \"other\" again");
+  msg ("sync");
+  sync ();
+  after = data_write_backs ();
+  if (after - before != 2 * BUF_BLOCKS)
+    fail ("sync wrote back %llu blocks, not %llu",
+          after - before, (unsigned long long) 2 * BUF_BLOCKS);
+
+  msg ("close \"data\"");
+  close (fd);
+  msg ("close \"other\"");
+  close (other_fd);
+}
@@ -0,0 +1,31 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-fsync) begin
+(cache-fsync) create "data"
+(cache-fsync) open "data"
+(cache-fsync) create "other"
+(cache-fsync) open "other"
+(cache-fsync) write "other"
+(cache-fsync) write "data"
+(cache-fsync) cachestat
+(cache-fsync) fsync "data"
+(cache-fsync) cachestat
+(cache-fsync) cachestat
+(cache-fsync) fsync "data"
+(cache-fsync) cachestat
+(cache-fsync) cachestat
+(cache-fsync) fsync "other"
+(cache-fsync) cachestat
+(cache-fsync) cachestat
+(cache-fsync) write "data" again
+(cache-fsync) write "other" again
+(cache-fsync) sync
+(cache-fsync) cachestat
+(cache-fsync) close "data"
+(cache-fsync) close "other"
+(cache-fsync) end
+EOF
+pass;
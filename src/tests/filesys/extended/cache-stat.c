@@ -0,0 +1,36 @@
+/* Reads a file twice and checks that cachestat() reports the
+   second read as served entirely from the buffer cache. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[4096];
+
+void
+test_main (void) 
+{
+  struct cache_stat before[CACHE_CLASS_CNT], after[CACHE_CLASS_CNT];
+  int fd;
+
+  memset (buf, 'x', sizeof buf);
+  CHECK (create ("data", sizeof buf), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"data\"");
+  seek (fd, 0);
+  CHECK (read (fd, buf, sizeof buf) == sizeof buf, "read \"data\"");
+  CHECK (cachestat (before), "cachestat");
+
+  seek (fd, 0);
+  CHECK (read (fd, buf, sizeof buf) == sizeof buf, "read \"data\" again");
+  CHECK (cachestat (after), "cachestat");
+  if (after[CACHE_DATA].misses != before[CACHE_DATA].misses)
+    fail ("second read missed the cache %llu times",
+          after[CACHE_DATA].misses - before[CACHE_DATA].misses);
+  if (after[CACHE_DATA].hits < before[CACHE_DATA].hits + sizeof buf / 512)
+    fail ("second read hit the cache only %llu times",
+          after[CACHE_DATA].hits - before[CACHE_DATA].hits);
+  msg ("close \"data\"");
+  close (fd);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-stat) begin
+(cache-stat) create "data"
+(cache-stat) open "data"
+(cache-stat) write "data"
+(cache-stat) read "data"
+(cache-stat) cachestat
+(cache-stat) read "data" again
+(cache-stat) cachestat
+(cache-stat) close "data"
+(cache-stat) end
+EOF
+pass;
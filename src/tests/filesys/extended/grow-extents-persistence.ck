@@ -0,0 +1,7 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($small) = join ('', map { chr ($_ % 255 + 1) x 512 . ($_ < 63 ? "\0" x 512 : "") } 0...63);
+check_archive ({"small" => [$small]});
+pass;
@@ -0,0 +1,75 @@
+/* Writes every other block of a file, first the even slots from
+   the start and then the odd ones from the end, so that no two
+   written blocks can share an extent, and reads it back.  Does so
+   twice, removing the file in between, with more data each time
+   than the disk could hold twice over, so that the space of the
+   first file must have been given back.  Then leaves a smaller
+   file of the same shape for the persistence check.
+
+   Run on a disk formatted with -fs-layout=extent, the first files
+   need a tree of extents two levels deep, built by inserting both
+   at its right edge and in its middle. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+
+/* Blocks written to each of the large files. */
+#define BIG_SLOTS 2048
+
+/* Blocks written to the file left behind. */
+#define SMALL_SLOTS 64
+
+static char block[BLOCK_SIZE];
+static unsigned char pair[BLOCK_SIZE * 2];
+
+/* Creates NAME and writes SLOT_CNT blocks to it, block I at byte
+   offset I * 2 * BLOCK_SIZE, filled with I % 255 + 1, leaving the
+   block after each one a hole.  Then checks its contents. */
+static void
+write_slots (const char *name, int slot_cnt)
+{
+  int fd, pass, i, j;
+
+  CHECK (create (name, 0), "create \"%s\"", name);
+  CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+  msg ("write \"%s\"", name);
+  for (pass = 0; pass < 2; pass++)
+    for (j = 0; j < slot_cnt / 2; j++)
+      {
+        i = pass == 0 ? 2 * j : slot_cnt - 1 - 2 * j;
+        memset (block, i % 255 + 1, sizeof block);
+        seek (fd, i * sizeof pair);
+        if (write (fd, block, sizeof block) != sizeof block)
+          fail ("write block %d of \"%s\" failed", i, name);
+      }
+
+  msg ("verify \"%s\"", name);
+  for (i = 0; i < slot_cnt; i++)
+    {
+      int size = i < slot_cnt - 1 ? sizeof pair : BLOCK_SIZE;
+
+      seek (fd, i * sizeof pair);
+      if (read (fd, pair, sizeof pair) != size)
+        fail ("read block %d of \"%s\" failed", i, name);
+      for (j = 0; j < size; j++)
+        if (pair[j] != (j < BLOCK_SIZE ? i % 255 + 1 : 0))
+          fail ("byte %d of \"%s\" is %d", i * (int) sizeof pair + j,
+                name, pair[j]);
+    }
+  msg ("close \"%s\"", name);
+  close (fd);
+}
+
+void
+test_main (void)
+{
+  write_slots ("big", BIG_SLOTS);
+  CHECK (remove ("big"), "remove \"big\"");
+  write_slots ("big", BIG_SLOTS);
+  CHECK (remove ("big"), "remove \"big\"");
+  write_slots ("small", SMALL_SLOTS);
+}
@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-extents) begin
+(grow-extents) create "big"
+(grow-extents) open "big"
+(grow-extents) write "big"
+(grow-extents) verify "big"
+(grow-extents) close "big"
+(grow-extents) remove "big"
+(grow-extents) create "big"
+(grow-extents) open "big"
+(grow-extents) write "big"
+(grow-extents) verify "big"
+(grow-extents) close "big"
+(grow-extents) remove "big"
+(grow-extents) create "small"
+(grow-extents) open "small"
+(grow-extents) write "small"
+(grow-extents) verify "small"
+(grow-extents) close "small"
+(grow-extents) end
+EOF
+pass;
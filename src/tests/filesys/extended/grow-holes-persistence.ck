@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($sparse) = "a" x 100 . "\0" x 69900 . "b" x 100 . "\0" x 53356
+  . "c" x 100 . "\0" x 81144 . "d" x 100;
+check_archive ({"sparse" => [$sparse]});
+pass;
@@ -0,0 +1,112 @@
+/* Writes a few small pieces of a file far apart, leaving holes
+   between them, and checks that the holes read as zeros, before
+   and, in the persistence check, after the file system is
+   remounted.
+
+   Then fills the disk with writes that do not end on a block
+   boundary, and checks that the write the disk cannot hold is
+   cut short exactly at the first block that could not be
+   mapped, that the file's size stops there, and that a write
+   past the end with no room left writes nothing and leaves the
+   size alone.  The disk is emptied again afterward, so that the
+   persistence check has room for its archive. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+
+/* Size of "sparse", and where its pieces go. */
+#define SPARSE_SIZE 204800
+#define PIECE_SIZE 100
+static const int piece_ofs[] = {0, 70000, 123456, SPARSE_SIZE - PIECE_SIZE};
+#define PIECE_CNT (int) (sizeof piece_ofs / sizeof *piece_ofs)
+
+/* Size of each write to "fill".  Odd, so that none of the writes
+   before the disk could be full start on a block boundary. */
+#define CHUNK_SIZE (16 * BLOCK_SIZE + 101)
+
+static char sparse[SPARSE_SIZE];
+static char chunk[CHUNK_SIZE];
+static char readback[CHUNK_SIZE];
+
+/* Fills chunk with the CNT bytes of "fill" starting at OFS. */
+static void
+fill_chunk (size_t ofs, size_t cnt)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    chunk[i] = (ofs + i) % 251;
+}
+
+void
+test_main (void)
+{
+  size_t ofs, pos, ret_val;
+  int fd, i;
+
+  for (i = 0; i < PIECE_CNT; i++)
+    memset (sparse + piece_ofs[i], 'a' + i, PIECE_SIZE);
+  CHECK (create ("sparse", 0), "create \"sparse\"");
+  CHECK ((fd = open ("sparse")) > 1, "open \"sparse\"");
+  msg ("write \"sparse\" in pieces");
+  for (i = PIECE_CNT - 1; i >= 0; i--)
+    {
+      seek (fd, piece_ofs[i]);
+      if (write (fd, sparse + piece_ofs[i], PIECE_SIZE) != PIECE_SIZE)
+        fail ("write at offset %d in \"sparse\" failed", piece_ofs[i]);
+    }
+  msg ("close \"sparse\"");
+  close (fd);
+  check_file ("sparse", sparse, SPARSE_SIZE);
+
+  CHECK (create ("fill", 0), "create \"fill\"");
+  CHECK ((fd = open ("fill")) > 1, "open \"fill\"");
+  msg ("write \"fill\" until the disk is full");
+  for (ofs = 0; ; ofs += ret_val)
+    {
+      fill_chunk (ofs, CHUNK_SIZE);
+      ret_val = write (fd, chunk, CHUNK_SIZE);
+      if (ret_val < CHUNK_SIZE)
+        break;
+    }
+  if ((ofs + ret_val) % BLOCK_SIZE != 0)
+    fail ("write at offset %zu cut short at %zu, not at a block boundary",
+          ofs, ofs + ret_val);
+  if (ofs % BLOCK_SIZE != 0 && ret_val < BLOCK_SIZE - ofs % BLOCK_SIZE)
+    fail ("write at offset %zu did not fill its first block, which "
+          "was already mapped", ofs);
+  ofs += ret_val;
+  if ((size_t) filesize (fd) != ofs)
+    fail ("size of \"fill\" is %d after a write cut short at %zu",
+          filesize (fd), ofs);
+  msg ("write \"fill\" past its end");
+  seek (fd, ofs + 10 * BLOCK_SIZE);
+  ret_val = write (fd, chunk, CHUNK_SIZE);
+  if (ret_val != 0)
+    fail ("write to a full disk wrote %zu bytes", ret_val);
+  if ((size_t) filesize (fd) != ofs)
+    fail ("size of \"fill\" is %d after a write that wrote nothing, "
+          "not %zu", filesize (fd), ofs);
+
+  msg ("verify \"fill\"");
+  seek (fd, 0);
+  for (pos = 0; pos < ofs; pos += ret_val)
+    {
+      size_t cnt = ofs - pos < CHUNK_SIZE ? ofs - pos : CHUNK_SIZE;
+
+      fill_chunk (pos, cnt);
+      ret_val = read (fd, readback, cnt);
+      if (ret_val != cnt)
+        fail ("read of %zu bytes at offset %zu in \"fill\" returned %zu",
+              cnt, pos, ret_val);
+      compare_bytes (readback, chunk, cnt, pos, "fill");
+    }
+  msg ("close \"fill\"");
+  close (fd);
+  CHECK (remove ("fill"), "remove \"fill\"");
+  check_file ("sparse", sparse, SPARSE_SIZE);
+}
@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-holes) begin
+(grow-holes) create "sparse"
+(grow-holes) open "sparse"
+(grow-holes) write "sparse" in pieces
+(grow-holes) close "sparse"
+(grow-holes) open "sparse" for verification
+(grow-holes) verified contents of "sparse"
+(grow-holes) close "sparse"
+(grow-holes) create "fill"
+(grow-holes) open "fill"
+(grow-holes) write "fill" until the disk is full
+(grow-holes) write "fill" past its end
+(grow-holes) verify "fill"
+(grow-holes) close "fill"
+(grow-holes) remove "fill"
+(grow-holes) open "sparse" for verification
+(grow-holes) verified contents of "sparse"
+(grow-holes) close "sparse"
+(grow-holes) end
+EOF
+pass;
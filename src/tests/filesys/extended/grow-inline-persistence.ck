@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($data) = random_bytes (2345);
+my ($hole) = substr ($data, 0, 100) . "\0" x 900 . substr ($data, 1000, 100);
+my ($exact) = substr ($data, 0, 500);
+check_archive ({"grow" => [$data], "hole" => [$hole], "exact" => [$exact]});
+pass;
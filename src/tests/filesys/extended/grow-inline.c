@@ -0,0 +1,87 @@
+/* Grows a file from empty to well past the INLINE_SIZE (500)
+   bytes that the file system keeps in the inode itself, checking
+   its contents while they are still inline, after the write that
+   crosses INLINE_SIZE moves them out to blocks, and at the end.
+   Also moves a second file out of its inode with a write that
+   starts past its end, and leaves a third at exactly INLINE_SIZE
+   bytes.  The persistence check reads all three back after the
+   file system is remounted. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define INLINE_SIZE 500
+#define FILE_SIZE 2345
+#define CHUNK_SIZE 150
+#define HOLE_OFS 1000
+#define HOLE_DATA 100
+
+static char buf[FILE_SIZE];
+static char hole_buf[HOLE_OFS + HOLE_DATA];
+
+/* Writes SIZE bytes of buf from offset OFS to the file NAME, open
+   as FD, at the same offset. */
+static void
+write_at (int fd, const char *name, size_t ofs, size_t size)
+{
+  size_t ret_val;
+
+  seek (fd, ofs);
+  ret_val = write (fd, buf + ofs, size);
+  if (ret_val != size)
+    fail ("write %zu bytes at offset %zu in \"%s\" returned %zu",
+          size, ofs, name, ret_val);
+}
+
+void
+test_main (void)
+{
+  size_t ofs;
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  /* Grow "grow" a chunk at a time, across INLINE_SIZE. */
+  CHECK (create ("grow", 0), "create \"grow\"");
+  CHECK ((fd = open ("grow")) > 1, "open \"grow\"");
+  msg ("write \"grow\" up to %d bytes", INLINE_SIZE);
+  for (ofs = 0; ofs + CHUNK_SIZE <= INLINE_SIZE; ofs += CHUNK_SIZE)
+    write_at (fd, "grow", ofs, CHUNK_SIZE);
+  check_file ("grow", buf, ofs);
+  msg ("write \"grow\" past %d bytes", INLINE_SIZE);
+  write_at (fd, "grow", ofs, CHUNK_SIZE);
+  ofs += CHUNK_SIZE;
+  check_file ("grow", buf, ofs);
+  msg ("write \"grow\" up to %d bytes", FILE_SIZE);
+  for (; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    write_at (fd, "grow", ofs,
+              FILE_SIZE - ofs < CHUNK_SIZE ? FILE_SIZE - ofs : CHUNK_SIZE);
+  msg ("close \"grow\"");
+  close (fd);
+  check_file ("grow", buf, FILE_SIZE);
+
+  /* Move "hole" out of its inode with a write past its end. */
+  memcpy (hole_buf, buf, HOLE_DATA);
+  memcpy (hole_buf + HOLE_OFS, buf + HOLE_OFS, HOLE_DATA);
+  CHECK (create ("hole", 0), "create \"hole\"");
+  CHECK ((fd = open ("hole")) > 1, "open \"hole\"");
+  msg ("write \"hole\" at 0 and %d", HOLE_OFS);
+  write_at (fd, "hole", 0, HOLE_DATA);
+  write_at (fd, "hole", HOLE_OFS, HOLE_DATA);
+  msg ("close \"hole\"");
+  close (fd);
+  check_file ("hole", hole_buf, sizeof hole_buf);
+
+  /* Fill "exact" to just what fits inline. */
+  CHECK (create ("exact", 0), "create \"exact\"");
+  CHECK ((fd = open ("exact")) > 1, "open \"exact\"");
+  msg ("write \"exact\"");
+  write_at (fd, "exact", 0, INLINE_SIZE);
+  msg ("close \"exact\"");
+  close (fd);
+  check_file ("exact", buf, INLINE_SIZE);
+}
@@ -0,0 +1,38 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-inline) begin
+(grow-inline) create "grow"
+(grow-inline) open "grow"
+(grow-inline) write "grow" up to 500 bytes
+(grow-inline) open "grow" for verification
+(grow-inline) verified contents of "grow"
+(grow-inline) close "grow"
+(grow-inline) write "grow" past 500 bytes
+(grow-inline) open "grow" for verification
+(grow-inline) verified contents of "grow"
+(grow-inline) close "grow"
+(grow-inline) write "grow" up to 2345 bytes
+(grow-inline) close "grow"
+(grow-inline) open "grow" for verification
+(grow-inline) verified contents of "grow"
+(grow-inline) close "grow"
+(grow-inline) create "hole"
+(grow-inline) open "hole"
+(grow-inline) write "hole" at 0 and 1000
+(grow-inline) close "hole"
+(grow-inline) open "hole" for verification
+(grow-inline) verified contents of "hole"
+(grow-inline) close "hole"
+(grow-inline) create "exact"
+(grow-inline) open "exact"
+(grow-inline) write "exact"
+(grow-inline) close "exact"
+(grow-inline) open "exact" for verification
+(grow-inline) verified contents of "exact"
+(grow-inline) close "exact"
+(grow-inline) end
+EOF
+pass;
@@ -34,6 +34,7 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -264,6 +265,16 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-wb-interval"))
+        cache_flush_interval = atoi (value);
+      else if (!strcmp (name, "-wb-ratio"))
+        cache_dirty_ratio = atoi (value);
+      else if (!strcmp (name, "-cache-policy"))
+        cache_set_policy (value);
+      else if (!strcmp (name, "-cache-max"))
+        cache_max_pages = atoi (value);
+      else if (!strcmp (name, "-fs-layout"))
+        filesys_set_layout (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -390,6 +401,11 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -wb-interval=MS    Write dirty cache blocks back every MS ms.\n"
+          "  -wb-ratio=PCT      Write back early when PCT%% of cache is dirty.\n"
+          "  -cache-policy=POL  Evict from the buffer cache by POL (lru or 2q).\n"
+          "  -cache-max=PAGES   Let the buffer cache grow to PAGES pages of RAM.\n"
+          "  -fs-layout=LAYOUT  Format with LAYOUT block maps (indexed or extent).\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -36,6 +36,9 @@ struct pool
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* Gives back cached pages when a pool runs dry, or null. */
+static palloc_shrink_func *shrinker;
+
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
@@ -81,6 +84,15 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
   lock_release (&pool->lock);
 
+  /* Ask the shrinker for memory and try once more. */
+  if (page_idx == BITMAP_ERROR && shrinker != NULL
+      && !(flags & PAL_NORECLAIM) && shrinker (flags, page_cnt) > 0)
+    {
+      lock_acquire (&pool->lock);
+      page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+      lock_release (&pool->lock);
+    }
+
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
   else
@@ -148,6 +160,15 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Installs SHRINK as the function called when an allocation
+   would otherwise fail.  SHRINK is called without any pool lock
+   held, and may free pages to either pool. */
+void
+palloc_set_shrinker (palloc_shrink_func *shrink)
+{
+  shrinker = shrink;
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
@@ -8,13 +8,20 @@ enum palloc_flags
   {
     PAL_ASSERT = 001,           /* Panic on failure. */
     PAL_ZERO = 002,             /* Zero page contents. */
-    PAL_USER = 004              /* User page. */
+    PAL_USER = 004,             /* User page. */
+    PAL_NORECLAIM = 010         /* Do not ask the shrinker for pages. */
   };
 
+/* Called when an allocation with FLAGS cannot be satisfied, to
+   give back up to PAGE_CNT pages held by a cache.  Returns the
+   number of pages freed.  Must not block. */
+typedef size_t palloc_shrink_func (enum palloc_flags flags, size_t page_cnt);
+
 void palloc_init (size_t user_page_limit);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+void palloc_set_shrinker (palloc_shrink_func *);
 
 #endif /* threads/palloc.h */
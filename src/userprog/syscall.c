@@ -1,5 +1,6 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include <threads/vaddr.h>
 #include "threads/interrupt.h"
@@ -15,6 +16,7 @@
 #include "vm/page.h"
 #endif
 #ifdef FILESYS
+#include "filesys/cache.h"
 #include "filesys/inode.h"
 #endif
 
@@ -42,12 +44,13 @@ static void sys_mkdir(struct intr_frame *f, const char *name);
 static void sys_readdir(struct intr_frame *f, int fd, char *name);
 static void sys_isdir(struct intr_frame *f, int fd);
 static void sys_inumber(struct intr_frame *f, int fd);
-
-static struct lock filesys_lock;
+static void sys_cachestat(struct intr_frame *f, struct cache_stat *stats);
+static void sys_advise(struct intr_frame *f, int fd, unsigned offset, unsigned length, int hint);
+static void sys_fsync(struct intr_frame *f, int fd);
+static void sys_sync(struct intr_frame *f);
 
 void
 syscall_init (void)  {
-  lock_init(&filesys_lock);
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
@@ -98,6 +101,7 @@ syscall_handler (struct intr_frame *f /*UNUSED*/)  {
     exit_status(f, -1);
   int syscall_num = *((int*)f->esp);
   void *arg1 = f->esp + 4, *arg2 = f->esp + 8, *arg3 = f->esp + 12;
+  void *arg4 = f->esp + 16;
 
   switch (syscall_num) {
     case SYS_EXIT: case SYS_EXEC: case SYS_WAIT: case SYS_TELL:  case SYS_REMOVE: case SYS_FILESIZE: case SYS_OPEN: case SYS_CLOSE:
@@ -106,6 +110,7 @@ syscall_handler (struct intr_frame *f /*UNUSED*/)  {
 #endif
 #ifdef FILESYS
     case SYS_MKDIR: case SYS_CHDIR: case SYS_ISDIR: case SYS_INUMBER:
+    case SYS_CACHESTAT: case SYS_FSYNC:
 #endif
       if(!check_user(arg1, 4, false))
         exit_status(f, -1);
@@ -124,6 +129,12 @@ syscall_handler (struct intr_frame *f /*UNUSED*/)  {
       if(!check_user(arg1, 12, false))
         exit_status(f, -1);
       break;
+#ifdef FILESYS
+    case SYS_ADVISE:
+      if(!check_user(arg1, 16, false))
+        exit_status(f, -1);
+      break;
+#endif
     default:;
   }
   switch (syscall_num) {
@@ -167,9 +178,18 @@ syscall_handler (struct intr_frame *f /*UNUSED*/)  {
     case SYS_READDIR:
       sys_readdir(f, *((int *)arg1), *((void **) arg2)); break;
     case SYS_ISDIR:
-      sys_isdir(f, *((int *)arg1));
+      sys_isdir(f, *((int *)arg1)); break;
     case SYS_INUMBER:
-      sys_inumber(f, *((int *)arg1));
+      sys_inumber(f, *((int *)arg1)); break;
+    case SYS_CACHESTAT:
+      sys_cachestat(f, *((void **) arg1)); break;
+    case SYS_ADVISE:
+      sys_advise(f, *((int *)arg1), *((unsigned *) arg2), *((unsigned *) arg3),
+                 *((int *)arg4)); break;
+    case SYS_FSYNC:
+      sys_fsync(f, *((int *)arg1)); break;
+    case SYS_SYNC:
+      sys_sync(f); break;
 #endif
   }
 
@@ -212,9 +232,7 @@ sys_write(struct intr_frame *f, int fd, const void *buffer, unsigned size) {
   } else {
     struct file_info *info = get_file_info(fd);
     if(info != NULL && info->opened_dir == NULL) {
-      lock_acquire(&filesys_lock);
       f->eax = (uint32_t)file_write(info->opened_file, buffer, size);
-      lock_release(&filesys_lock);
     } else {
 //      printf("not open");
       exit_status(f, -1);
@@ -236,9 +254,7 @@ sys_read(struct intr_frame *f, int fd, const void *buffer, unsigned size) {
   } else {
     struct file_info *info = get_file_info(fd);
     if(info != NULL) {
-      lock_acquire(&filesys_lock);
       f->eax = (uint32_t)file_read(info->opened_file, (void *)buffer, size);
-      lock_release(&filesys_lock);
     } else {
       exit_status(f, -1);
     }
@@ -246,9 +262,7 @@ sys_read(struct intr_frame *f, int fd, const void *buffer, unsigned size) {
 }
 
 void close_file(struct file *file1) {
-  lock_acquire(&filesys_lock);
   file_close(file1);
-  lock_release(&filesys_lock);
 }
 
 bool
@@ -273,9 +287,7 @@ sys_exec(struct intr_frame *f, const char *cmd_line) {
   if(!check_string(cmd_line)) {
     exit_status(f, -1);
   }
-  lock_acquire(&filesys_lock);
   f->eax = (uint32_t)process_execute(cmd_line);
-  lock_release(&filesys_lock);
   struct list_elem *e;
   struct thread *cur = thread_current();
   struct child_info *l;
@@ -294,9 +306,7 @@ static void
 sys_open(struct intr_frame *f, const char *name) {
   if(!check_string(name))
     exit_status(f, -1);
-  lock_acquire(&filesys_lock);
   struct file *tmp = filesys_open(name);
-  lock_release(&filesys_lock);
   if(tmp == NULL) {
     f->eax = (uint32_t)-1;
     return ;
@@ -305,8 +315,9 @@ sys_open(struct intr_frame *f, const char *name) {
   struct file_info *info = malloc(sizeof(struct file_info));
   info->opened_file = tmp;
   info->thread_num = thread_current();
+  enum intr_level old_level = intr_disable();
   info->fd = fd_next++;
-  lock_acquire(&filesys_lock);
+  intr_set_level(old_level);
   struct inode *inode = file_get_inode(info->opened_file);
   if(inode != NULL && inode_is_dir(inode)) {
     info->opened_dir = dir_open( inode_reopen(inode) );
@@ -314,7 +325,6 @@ sys_open(struct intr_frame *f, const char *name) {
   else
     info->opened_dir = NULL;
 
-  lock_release(&filesys_lock);
   add_file_list(info);
   f->eax = (uint32_t)info->fd;
 }
@@ -323,27 +333,21 @@ static void
 sys_create(struct intr_frame *f, const char *name, unsigned initial_size) {
   if(!check_string(name))
     exit_status(f, -1);
-  lock_acquire(&filesys_lock);
   f->eax = (uint32_t)filesys_create(name, initial_size, false);
-  lock_release(&filesys_lock);
 }
 
 static void
 sys_remove(struct intr_frame *f, const char *name) {
   if(!check_string(name))
     exit_status(f, -1);
-  lock_acquire(&filesys_lock);
   f->eax = (uint32_t)filesys_remove(name);
-  lock_release(&filesys_lock);
 }
 
 static void
 sys_filesize(struct intr_frame *f, int fd) {
   struct file_info *info = get_file_info(fd);
   if(info != NULL) {
-    lock_acquire(&filesys_lock);
     f->eax = (uint32_t)file_length(info->opened_file);
-    lock_release(&filesys_lock);
   } else {
     exit_status(f, -1);
   }
@@ -353,11 +357,9 @@ static void
 sys_close(struct intr_frame *f, int fd) {
   struct file_info *info = get_file_info(fd);
   if(info != NULL) {
-    lock_acquire(&filesys_lock);
     file_close(info->opened_file);
     if(info->opened_dir != NULL)
       dir_close(info->opened_dir);
-    lock_release(&filesys_lock);
     list_remove(&info->elem);
     free(info);
   } else {
@@ -369,9 +371,7 @@ static void
 sys_tell(struct intr_frame *f, int fd) {
   struct file_info *info = get_file_info(fd);
   if(info != NULL) {//--------------------need change after filesys finished -------
-    lock_acquire(&filesys_lock);
     f->eax = (uint32_t)file_tell(info->opened_file);
-    lock_release(&filesys_lock);
   } else {
     exit_status(f, -1);
   }
@@ -381,9 +381,7 @@ static void
 sys_seek(struct intr_frame *f, int fd, unsigned position) {
   struct file_info *info = get_file_info(fd);
   if(info != NULL) {
-    lock_acquire(&filesys_lock);
     file_seek(info->opened_file, position);
-    lock_release(&filesys_lock);
   } else {
     exit_status(f, -1);
   }
@@ -549,9 +547,7 @@ sys_chdir(struct intr_frame *f, const char *name)
 //  bool return_code;
 //  check_user((const uint8_t*) filename);
 
-  lock_acquire (&filesys_lock);
   f->eax = filesys_chdir(name);
-  lock_release (&filesys_lock);
 
 //  return return_code;
 }
@@ -564,9 +560,7 @@ sys_mkdir(struct intr_frame *f, const char *name)
 //  bool return_code;
 //  check_user((const uint8_t*) filename);
 
-  lock_acquire (&filesys_lock);
   f->eax = filesys_create(name, 0, true);
-  lock_release (&filesys_lock);
 
 //  return return_code;
 }
@@ -581,7 +575,6 @@ sys_readdir(struct intr_frame *f, int fd, char *name)
 //  bool ret = false;
   f->eax = 0;
 
-  lock_acquire (&filesys_lock);
   //file_d = find_file_desc(thread_current(), fd, FD_DIRECTORY);
   struct file_info *info = get_file_info(fd);
   if (info == NULL) goto done;
@@ -600,14 +593,12 @@ sys_readdir(struct intr_frame *f, int fd, char *name)
   f->eax = dir_readdir (info->opened_dir, name);
 
   done:
-  lock_release (&filesys_lock);
 //  return ret;
 }
 
 static void
 sys_isdir(struct intr_frame *f, int fd)
 {
-  lock_acquire (&filesys_lock);
 
   struct file_info *info = get_file_info(fd);
   if (info == NULL) {
@@ -616,14 +607,12 @@ sys_isdir(struct intr_frame *f, int fd)
   }
   f->eax = inode_is_dir (file_get_inode(info->opened_file));
 
-  lock_release (&filesys_lock);
 //  return ret;
 }
 
 static void
 sys_inumber(struct intr_frame *f, int fd)
 {
-  lock_acquire (&filesys_lock);
 
 //  struct file_desc* file_d = find_file_desc(thread_current(), fd, FD_FILE | FD_DIRECTORY);
   struct file_info *info = get_file_info(fd);
@@ -633,8 +622,51 @@ sys_inumber(struct intr_frame *f, int fd)
   }
   f->eax = (int) inode_get_inumber (file_get_inode(info->opened_file));
 
-  lock_release (&filesys_lock);
 //  return ret;
 }
 
+static void
+sys_cachestat(struct intr_frame *f, struct cache_stat *stats)
+{
+  struct cache_stat tmp[CACHE_CLASS_CNT];
+
+  if(!check_user((const char *) stats, sizeof tmp, true))
+    exit_status(f, -1);
+
+  /* Copy through a kernel buffer, so that no page fault can occur
+     while the cache's lock is held. */
+  cache_get_stats(tmp);
+  memcpy(stats, tmp, sizeof tmp);
+  f->eax = true;
+}
+
+static void
+sys_advise(struct intr_frame *f, int fd, unsigned offset, unsigned length, int hint)
+{
+  struct file_info *info = get_file_info(fd);
+  if(info == NULL)
+    exit_status(f, -1);
+  if(offset > INT32_MAX || length > INT32_MAX - offset) {
+    f->eax = false;
+    return;
+  }
+  f->eax = file_advise(info->opened_file, offset, length, hint);
+}
+
+static void
+sys_fsync(struct intr_frame *f, int fd)
+{
+  struct file_info *info = get_file_info(fd);
+  if(info == NULL)
+    exit_status(f, -1);
+  inode_flush(file_get_inode(info->opened_file));
+  f->eax = true;
+}
+
+static void
+sys_sync(struct intr_frame *f UNUSED)
+{
+  cache_flush();
+}
+
 #endif